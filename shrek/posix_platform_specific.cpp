@@ -0,0 +1,199 @@
+#ifdef _WIN32
+#error Incorrect platform
+#endif
+
+#include <cerrno>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <filesystem>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "fmt/core.h"
+
+#include "shrek.h"
+#include "shrek_platform_specific.h"
+
+namespace shrek
+{
+    namespace fs = std::filesystem;
+
+    void load_module(ShrekHandle* shrek, const fs::path& file);
+    static bool read_fd(int fd, std::string& result);
+
+    SourceText::~SourceText()
+    {
+        release();
+    }
+
+    void SourceText::release()
+    {
+        if (m_mapping)
+        {
+            munmap(m_mapping, m_size);
+            m_mapping = nullptr;
+        }
+
+        m_buffer.clear();
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+    bool read_all_text(const std::string& utf8_filename, SourceText& result)
+    {
+        result.release();
+
+        int fd = open(utf8_filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        struct stat info;
+        if (fstat(fd, &info) != 0)
+        {
+            close(fd);
+            return false;
+        }
+
+        auto ok = true;
+        if (S_ISREG(info.st_mode) && info.st_size > 0)
+        {
+            // Map the file so the parser reads the page cache directly. The mapping stays valid after the descriptor
+            // is closed.
+            auto size = (std::size_t)info.st_size;
+            void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+            if (mapping != MAP_FAILED)
+            {
+                madvise(mapping, size, MADV_SEQUENTIAL);
+
+                result.m_mapping = mapping;
+                result.m_data = static_cast<const char*>(mapping);
+                result.m_size = size;
+            }
+            else
+            {
+                ok = read_fd(fd, result.m_buffer);
+            }
+        }
+        else if (!S_ISREG(info.st_mode))
+        {
+            // Pipes and other special files can not be mapped.
+            ok = read_fd(fd, result.m_buffer);
+        }
+
+        close(fd);
+
+        if (ok && !result.m_mapping)
+        {
+            result.m_data = result.m_buffer.data();
+            result.m_size = result.m_buffer.size();
+        }
+
+        return ok;
+    }
+
+    static bool read_fd(int fd, std::string& result)
+    {
+        char buffer[64 * 1024];
+
+        for (;;)
+        {
+            auto count = read(fd, buffer, sizeof(buffer));
+            if (count == 0)
+            {
+                return true;
+            }
+
+            if (count < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+
+                return false;
+            }
+
+            result.append(buffer, (std::size_t)count);
+        }
+    }
+
+    void discover_modules(ShrekHandle* shrek)
+    {
+        for (const auto& file : fs::directory_iterator(fs::current_path()))
+        {
+            auto ext = file.path().extension();
+            if (ext == ".dnky")
+            {
+                load_module(shrek, file.path());
+            }
+        }
+    }
+
+    std::size_t peak_memory_usage()
+    {
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+        {
+            return 0;
+        }
+
+        // Linux reports the maximum resident set size in kilobytes.
+        return (std::size_t)usage.ru_maxrss * 1024;
+    }
+
+    void* allocate_executable_memory(std::size_t size)
+    {
+        void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return memory == MAP_FAILED ? nullptr : memory;
+    }
+
+    bool protect_executable_memory(void* memory, std::size_t size)
+    {
+        return mprotect(memory, size, PROT_READ | PROT_EXEC) == 0;
+    }
+
+    void free_executable_memory(void* memory, std::size_t size)
+    {
+        munmap(memory, size);
+    }
+
+    void load_module(ShrekHandle* shrek, const fs::path& file)
+    {
+        // Resolve every symbol now, so a module with missing symbols fails here instead of in the middle of a program.
+        void* handle = dlopen(file.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (handle == nullptr)
+        {
+            fmt::print("Failed to load module \"{}\": {}\n", file.string(), dlerror());
+            return;
+        }
+
+        // Make the procedure name based off of the file name, with the extension removed.
+        auto proc_name = file.stem().string() + "_register";
+
+        void* register_func_raw = dlsym(handle, proc_name.c_str());
+        if (register_func_raw == nullptr)
+        {
+            fmt::print("Failed to register functions in \"{}\"\n", file.string());
+
+            dlclose(handle);
+            return;
+        }
+
+        ShrekRegister register_func = (ShrekRegister)register_func_raw;
+        int rc = register_func(shrek);
+
+        if (rc != SHREK_OK)
+        {
+            // The handle stays open, since functions registered before the failure are already in the function table.
+            fmt::print("Failed register function in \"{}\" returned unsuccessful return code\n", file.string());
+            return;
+        }
+
+        // The handle is not closed. The module's functions are in the function table, so it stays loaded until the
+        // process exits.
+    }
+}
@@ -1,129 +1,241 @@
-#include "shrek.h"
-
-#include "shrek.h"
-#include "shrek_runtime.h"
-
-#ifdef __cplusplus
-extern "C"
-#endif
-{
-
-typedef struct ShrekHandle
-{
-    void* runtime;
-} ShrekHandle;
-
-shrek_API_FUNC(ShrekHandle*) shrek_new_runtime()
-{
-    auto shrek = new ShrekHandle;
-
-    auto rt = new shrek::ShrekRuntime(shrek);
-    shrek->runtime = (void*)rt;
-
-    return shrek;
-}
-
-shrek_API_FUNC(void) shrek_free_runtime(ShrekHandle* shrek)
-{
-    if (shrek)
-    {
-        auto runtime = (shrek::ShrekRuntime*)shrek->runtime;
-        delete runtime;
-        delete shrek;
-    }
-}
-
-shrek_API_FUNC(int) shrek_run(ShrekHandle* shrek, int argc, const char** argv)
-{
-    auto rt = (shrek::ShrekRuntime*)shrek->runtime;
-    return rt->run(argc, argv);
-}
-
-shrek_API_FUNC(int) shrek_register_func(ShrekHandle* shrek, int func_number, ShrekFunc func)
-{
-    if (!shrek)
-    {
-        return SHREK_ERROR;
-    }
-
-    auto rt = (shrek::ShrekRuntime*)shrek->runtime;
-    if (!rt->register_function(func_number, func))
-    {
-        return SHREK_ERROR;
-    }
-
-    return SHREK_OK;
-}
-
-shrek_API_FUNC(void) shrek_set_except(ShrekHandle* shrek, const char* errmsg)
-{
-    if (!shrek)
-    {
-        return;
-    }
-
-    auto rt = (shrek::ShrekRuntime*)shrek->runtime;
-
-    // TODO: Implement this.
-}
-
-shrek_API_FUNC(int) shrek_stack_size(ShrekHandle* shrek)
-{
-    if (!shrek)
-    {
-        return SHREK_ERROR;
-    }
-
-    auto rt = (shrek::ShrekRuntime*)shrek->runtime;
-
-    return (int)rt->stack().size();
-}
-
-shrek_API_FUNC(int) shrek_pop(ShrekHandle* shrek, int* out_value)
-{
-    if (shrek_peek(shrek, out_value) != SHREK_OK)
-    {
-        return SHREK_ERROR;
-    }
-
-    auto rt = (shrek::ShrekRuntime*)shrek->runtime;
-    rt->stack().pop();
-
-    return SHREK_OK;
-}
-
-shrek_API_FUNC(int) shrek_push(ShrekHandle* shrek, int value)
-{
-    if (!shrek)
-    {
-        return SHREK_ERROR;
-    }
-
-    auto rt = (shrek::ShrekRuntime*)shrek->runtime;
-    rt->stack().push(value);
-    return SHREK_OK;
-}
-
-shrek_API_FUNC(int) shrek_peek(ShrekHandle* shrek, int* out_value)
-{
-    if (!shrek)
-    {
-        return SHREK_ERROR;
-    }
-
-    auto rt = (shrek::ShrekRuntime*)shrek->runtime;
-
-    if (rt->stack().empty())
-    {
-        out_value = 0;
-        return SHREK_ERROR;
-    }
-
-    *out_value = rt->stack().top();
-
-    return SHREK_OK;
-}
-
-#ifdef __cplusplus
-}
-#endif
+#include "shrek.h"
+
+#include <algorithm>
+
+#include "shrek.h"
+#include "shrek_runtime.h"
+
+#ifdef __cplusplus
+extern "C"
+#endif
+{
+
+typedef struct ShrekHandle
+{
+    void* runtime;
+} ShrekHandle;
+
+shrek_API_FUNC(ShrekHandle*) shrek_new_runtime()
+{
+    auto shrek = new ShrekHandle;
+
+    auto rt = new shrek::ShrekRuntime(shrek);
+    shrek->runtime = (void*)rt;
+
+    return shrek;
+}
+
+shrek_API_FUNC(void) shrek_free_runtime(ShrekHandle* shrek)
+{
+    if (shrek)
+    {
+        auto runtime = (shrek::ShrekRuntime*)shrek->runtime;
+        delete runtime;
+        delete shrek;
+    }
+}
+
+shrek_API_FUNC(int) shrek_run(ShrekHandle* shrek, int argc, const char** argv)
+{
+    auto rt = (shrek::ShrekRuntime*)shrek->runtime;
+    return rt->run(argc, argv);
+}
+
+shrek_API_FUNC(int) shrek_register_func(ShrekHandle* shrek, int func_number, ShrekFunc func)
+{
+    if (!shrek)
+    {
+        return SHREK_ERROR;
+    }
+
+    shrek::FunctionEntry entry;
+    entry.func = func;
+
+    auto rt = (shrek::ShrekRuntime*)shrek->runtime;
+    if (!rt->register_function(func_number, entry))
+    {
+        return SHREK_ERROR;
+    }
+
+    return SHREK_OK;
+}
+
+shrek_API_FUNC(int) shrek_register_func_fast(ShrekHandle* shrek, int func_number, ShrekFastFunc func, int arg_count,
+    int result_count)
+{
+    if (!shrek || arg_count < 0 || result_count < 0)
+    {
+        return SHREK_ERROR;
+    }
+
+    shrek::FunctionEntry entry;
+    entry.fast_func = func;
+    entry.arg_count = arg_count;
+    entry.result_count = result_count;
+
+    auto rt = (shrek::ShrekRuntime*)shrek->runtime;
+    if (!rt->register_function(func_number, entry))
+    {
+        return SHREK_ERROR;
+    }
+
+    return SHREK_OK;
+}
+
+shrek_API_FUNC(void) shrek_set_except(ShrekHandle* shrek, const char* errmsg)
+{
+    if (!shrek)
+    {
+        return;
+    }
+
+    auto rt = (shrek::ShrekRuntime*)shrek->runtime;
+    rt->set_func_exception(errmsg ? errmsg : "");
+}
+
+shrek_API_FUNC(int) shrek_stack_size(ShrekHandle* shrek)
+{
+    if (!shrek)
+    {
+        return SHREK_ERROR;
+    }
+
+    auto rt = (shrek::ShrekRuntime*)shrek->runtime;
+
+    return (int)rt->stack().size();
+}
+
+shrek_API_FUNC(int) shrek_pop(ShrekHandle* shrek, int* out_value)
+{
+    if (shrek_peek(shrek, out_value) != SHREK_OK)
+    {
+        return SHREK_ERROR;
+    }
+
+    auto rt = (shrek::ShrekRuntime*)shrek->runtime;
+    rt->stack().pop();
+
+    return SHREK_OK;
+}
+
+shrek_API_FUNC(int) shrek_push(ShrekHandle* shrek, int value)
+{
+    if (!shrek)
+    {
+        return SHREK_ERROR;
+    }
+
+    auto rt = (shrek::ShrekRuntime*)shrek->runtime;
+
+    try
+    {
+        rt->stack().push(value);
+    }
+    catch (const shrek::RuntimeError& ex)
+    {
+        rt->set_func_exception(ex.what());
+        return SHREK_ERROR;
+    }
+
+    return SHREK_OK;
+}
+
+shrek_API_FUNC(int) shrek_peek(ShrekHandle* shrek, int* out_value)
+{
+    if (!shrek)
+    {
+        return SHREK_ERROR;
+    }
+
+    auto rt = (shrek::ShrekRuntime*)shrek->runtime;
+
+    if (rt->stack().empty())
+    {
+        out_value = 0;
+        return SHREK_ERROR;
+    }
+
+    *out_value = rt->stack().top();
+
+    return SHREK_OK;
+}
+
+shrek_API_FUNC(int) shrek_push_n(ShrekHandle* shrek, const int* values, int count, int reverse)
+{
+    if (!shrek || count < 0 || (count > 0 && !values))
+    {
+        return SHREK_ERROR;
+    }
+
+    auto rt = (shrek::ShrekRuntime*)shrek->runtime;
+
+    try
+    {
+        if (reverse)
+        {
+            rt->stack().push_n_reversed(values, (std::size_t)count);
+        }
+        else
+        {
+            rt->stack().push_n(values, (std::size_t)count);
+        }
+    }
+    catch (const shrek::RuntimeError& ex)
+    {
+        rt->set_func_exception(ex.what());
+        return SHREK_ERROR;
+    }
+
+    return SHREK_OK;
+}
+
+shrek_API_FUNC(int) shrek_pop_n(ShrekHandle* shrek, int* out_values, int count)
+{
+    const int* values;
+    if (shrek_stack_view(shrek, count, &values) != SHREK_OK || (count > 0 && !out_values))
+    {
+        return SHREK_ERROR;
+    }
+
+    std::copy(values, values + count, out_values);
+
+    auto rt = (shrek::ShrekRuntime*)shrek->runtime;
+    rt->stack().pop_n((std::size_t)count);
+
+    return SHREK_OK;
+}
+
+shrek_API_FUNC(int) shrek_stack_view(ShrekHandle* shrek, int count, const int** out_values)
+{
+    int* values;
+    if (shrek_stack_view_mut(shrek, count, &values) != SHREK_OK)
+    {
+        return SHREK_ERROR;
+    }
+
+    *out_values = values;
+    return SHREK_OK;
+}
+
+shrek_API_FUNC(int) shrek_stack_view_mut(ShrekHandle* shrek, int count, int** out_values)
+{
+    if (!shrek || !out_values || count < 0)
+    {
+        return SHREK_ERROR;
+    }
+
+    auto rt = (shrek::ShrekRuntime*)shrek->runtime;
+    auto& stack = rt->stack();
+
+    if (stack.size() < (std::size_t)count)
+    {
+        return SHREK_ERROR;
+    }
+
+    *out_values = stack.data() + stack.size() - count;
+    return SHREK_OK;
+}
+
+#ifdef __cplusplus
+}
+#endif
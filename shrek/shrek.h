@@ -1,45 +1,58 @@
-#ifndef _SHREK_H_INCLUDE_GUARD
-#define _SHREK_H_INCLUDE_GUARD
-
-#include "shrek_exports.h"
-
-#ifdef __cplusplus
-extern "C"
-#endif
-{
-
-#define SHREK_OK 0
-#define SHREK_ERROR 1
-
-typedef struct ShrekHandle ShrekHandle;
-
-typedef int (*ShrekFunc)(ShrekHandle*);
-
-typedef int (*ShrekRegister)(ShrekHandle* shrek);
-
-// Runtime API
-shrek_API_FUNC(ShrekHandle*) shrek_new_runtime();
-
-shrek_API_FUNC(void) shrek_free_runtime(ShrekHandle* shrek);
-
-shrek_API_FUNC(int) shrek_run(ShrekHandle* shrek, int argc, const char **argv);
-
-shrek_API_FUNC(int) shrek_register_func(ShrekHandle* shrek, int func_number, ShrekFunc func);
-
-shrek_API_FUNC(void) shrek_set_except(ShrekHandle* shrek, const char* errmsg);
-
-shrek_API_FUNC(int) shrek_stack_size(ShrekHandle* shrek);
-
-shrek_API_FUNC(int) shrek_pop(ShrekHandle* shrek, int* out_value);
-
-shrek_API_FUNC(int) shrek_push(ShrekHandle* shrek, int value);
-
-shrek_API_FUNC(int) shrek_peek(ShrekHandle* shrek, int* out_value);
-
-// Parser API - TODO
-
-#ifdef __cplusplus
-}
-#endif
-
-#endif // _SHREK_H_INCLUDE_GUARD
+#ifndef _SHREK_H_INCLUDE_GUARD
+#define _SHREK_H_INCLUDE_GUARD
+
+#include "shrek_exports.h"
+
+#ifdef __cplusplus
+extern "C"
+#endif
+{
+
+#define SHREK_OK 0
+#define SHREK_ERROR 1
+
+typedef struct ShrekHandle ShrekHandle;
+
+typedef int (*ShrekFunc)(ShrekHandle*);
+
+typedef int (*ShrekFastFunc)(ShrekHandle* shrek, const int* args, int* results);
+
+typedef int (*ShrekRegister)(ShrekHandle* shrek);
+
+// Runtime API
+shrek_API_FUNC(ShrekHandle*) shrek_new_runtime();
+
+shrek_API_FUNC(void) shrek_free_runtime(ShrekHandle* shrek);
+
+shrek_API_FUNC(int) shrek_run(ShrekHandle* shrek, int argc, const char **argv);
+
+shrek_API_FUNC(int) shrek_register_func(ShrekHandle* shrek, int func_number, ShrekFunc func);
+
+shrek_API_FUNC(int) shrek_register_func_fast(ShrekHandle* shrek, int func_number, ShrekFastFunc func, int arg_count,
+    int result_count);
+
+shrek_API_FUNC(void) shrek_set_except(ShrekHandle* shrek, const char* errmsg);
+
+shrek_API_FUNC(int) shrek_stack_size(ShrekHandle* shrek);
+
+shrek_API_FUNC(int) shrek_pop(ShrekHandle* shrek, int* out_value);
+
+shrek_API_FUNC(int) shrek_push(ShrekHandle* shrek, int value);
+
+shrek_API_FUNC(int) shrek_peek(ShrekHandle* shrek, int* out_value);
+
+shrek_API_FUNC(int) shrek_push_n(ShrekHandle* shrek, const int* values, int count, int reverse);
+
+shrek_API_FUNC(int) shrek_pop_n(ShrekHandle* shrek, int* out_values, int count);
+
+shrek_API_FUNC(int) shrek_stack_view(ShrekHandle* shrek, int count, const int** out_values);
+
+shrek_API_FUNC(int) shrek_stack_view_mut(ShrekHandle* shrek, int count, int** out_values);
+
+// Parser API - TODO
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _SHREK_H_INCLUDE_GUARD
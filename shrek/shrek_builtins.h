@@ -1,11 +1,24 @@
-#ifndef _SHREK_BUILTINS_H_INCLUDE_GUARD
-#define _SHREK_BUILTINS_H_INCLUDE_GUARD
-
-#include "shrek.h"
-
-extern "C"
-{
-    shrek_API_FUNC(int) shrek_builtins_register(ShrekHandle* handle);
-}
-
-#endif // !_SHREK_BUILTINS_H_INCLUDE_GUARD
+#ifndef _SHREK_BUILTINS_H_INCLUDE_GUARD
+#define _SHREK_BUILTINS_H_INCLUDE_GUARD
+
+#include "shrek.h"
+
+namespace shrek
+{
+    namespace builtins
+    {
+        // Function registered by shrek_builtins_register for the given number, or nullptr if the number is not a
+        // built-in. The runtime compares against it to run unmodified built-ins as intrinsics.
+        ShrekFunc builtin_func(int func_number);
+
+        // True if func is one of the built-ins, under any function number.
+        bool is_builtin_func(ShrekFunc func);
+    }
+}
+
+extern "C"
+{
+    shrek_API_FUNC(int) shrek_builtins_register(ShrekHandle* handle);
+}
+
+#endif // !_SHREK_BUILTINS_H_INCLUDE_GUARD
@@ -0,0 +1,344 @@
+#include "shrek_bytecode_cache.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include "fmt/format.h"
+
+#include "shrek_platform_specific.h"
+
+namespace shrek
+{
+    namespace fs = std::filesystem;
+
+    // Bump the version whenever the layout or the numbering of OpCode changes.
+    constexpr std::uint32_t byte_code_magic = 0x43524853; // "SHRC"
+    constexpr std::uint32_t byte_code_format_version = 2;
+    constexpr std::uint32_t flag_source_index = 1;
+    constexpr std::uint32_t flag_source_text = 2;
+
+    struct ByteCodeHeader
+    {
+        std::uint32_t magic;
+        std::uint32_t version;
+        std::uint64_t source_hash;
+        std::uint64_t source_size;
+        std::uint64_t code_count;
+        std::uint32_t flags;
+        std::uint32_t reserved;
+        std::uint64_t payload_hash;
+    };
+
+    struct ByteCodeRecord
+    {
+        std::uint32_t op_code;
+        std::int32_t a;
+    };
+
+    static std::uint64_t hash_bytes(const char* data, std::size_t size);
+    static bool is_parser_op_code(std::uint32_t op_code);
+    static bool read_cache_entry(const fs::path& path, std::string_view source, std::vector<ByteCode>& result);
+
+    SourceKey make_source_key(std::string_view source)
+    {
+        SourceKey key;
+        key.hash = hash_bytes(source.data(), source.size());
+        key.size = source.size();
+
+        return key;
+    }
+
+    std::string serialize_byte_code(const std::vector<ByteCode>& code, const SourceKey& key, bool include_source_index,
+        std::optional<std::string_view> source_text)
+    {
+        auto payload_size = code.size() * sizeof(ByteCodeRecord);
+        if (include_source_index)
+        {
+            payload_size += code.size() * sizeof(std::uint64_t);
+        }
+
+        // The source text follows the payload. It is compared in full when the image is loaded, so it is not hashed.
+        auto text_size = source_text ? source_text->size() : 0;
+
+        std::string image(sizeof(ByteCodeHeader) + payload_size + text_size, '\0');
+        auto payload = &image[sizeof(ByteCodeHeader)];
+
+        for (std::size_t i = 0; i < code.size(); ++i)
+        {
+            ByteCodeRecord record;
+            record.op_code = (std::uint32_t)code[i].op_code;
+            record.a = code[i].a;
+
+            std::memcpy(payload + i * sizeof(record), &record, sizeof(record));
+        }
+
+        if (include_source_index)
+        {
+            auto indexes = payload + code.size() * sizeof(ByteCodeRecord);
+            for (std::size_t i = 0; i < code.size(); ++i)
+            {
+                std::uint64_t index = code[i].source_code_index;
+                std::memcpy(indexes + i * sizeof(index), &index, sizeof(index));
+            }
+        }
+
+        if (source_text)
+        {
+            std::memcpy(payload + payload_size, source_text->data(), text_size);
+        }
+
+        ByteCodeHeader header;
+        header.magic = byte_code_magic;
+        header.version = byte_code_format_version;
+        header.source_hash = key.hash;
+        header.source_size = key.size;
+        header.code_count = code.size();
+        header.flags = (include_source_index ? flag_source_index : 0) | (source_text ? flag_source_text : 0);
+        header.reserved = 0;
+        header.payload_hash = hash_bytes(payload, payload_size);
+
+        std::memcpy(&image[0], &header, sizeof(header));
+
+        return image;
+    }
+
+    bool deserialize_byte_code(std::string_view image, std::vector<ByteCode>& result, SourceKey& key,
+        std::optional<std::string_view>* source_text)
+    {
+        ByteCodeHeader header;
+        if (image.size() < sizeof(header))
+        {
+            return false;
+        }
+
+        std::memcpy(&header, image.data(), sizeof(header));
+        if (header.magic != byte_code_magic || header.version != byte_code_format_version)
+        {
+            return false;
+        }
+
+        auto record_size = sizeof(ByteCodeRecord);
+        if (header.flags & flag_source_index)
+        {
+            record_size += sizeof(std::uint64_t);
+        }
+
+        auto payload = image.substr(sizeof(header));
+        std::optional<std::string_view> text;
+        if (header.flags & flag_source_text)
+        {
+            if (header.source_size > payload.size())
+            {
+                return false;
+            }
+
+            auto payload_size = payload.size() - (std::size_t)header.source_size;
+            text = payload.substr(payload_size);
+            payload = payload.substr(0, payload_size);
+        }
+
+        if (header.code_count != payload.size() / record_size || payload.size() % record_size != 0)
+        {
+            return false;
+        }
+
+        if (hash_bytes(payload.data(), payload.size()) != header.payload_hash)
+        {
+            return false;
+        }
+
+        auto count = (std::size_t)header.code_count;
+        auto indexes = payload.data() + count * sizeof(ByteCodeRecord);
+
+        std::vector<ByteCode> code(count);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            ByteCodeRecord record;
+            std::memcpy(&record, payload.data() + i * sizeof(record), sizeof(record));
+
+            if (!is_parser_op_code(record.op_code))
+            {
+                return false;
+            }
+
+            // Label numbers are dense, so they are always less than the number of byte codes. Checking keeps a bad
+            // image from making the linker allocate a huge label table.
+            auto op_code = (OpCode)record.op_code;
+            if ((op_code == OpCode::label || op_code == OpCode::jump) && (record.a < 0 || (std::size_t)record.a >= count))
+            {
+                return false;
+            }
+
+            // Nothing else the parser emits has an operand, and the runtime relies on a being 0 for push0.
+            if (op_code != OpCode::label && op_code != OpCode::jump && record.a != 0)
+            {
+                return false;
+            }
+
+            code[i].op_code = op_code;
+            code[i].a = record.a;
+
+            if (header.flags & flag_source_index)
+            {
+                std::uint64_t index;
+                std::memcpy(&index, indexes + i * sizeof(index), sizeof(index));
+                code[i].source_code_index = (std::size_t)index;
+            }
+            else
+            {
+                code[i].source_code_index = 0;
+            }
+        }
+
+        key.hash = header.source_hash;
+        key.size = header.source_size;
+        result = std::move(code);
+
+        if (source_text)
+        {
+            *source_text = text;
+        }
+
+        return true;
+    }
+
+    bool write_byte_code_file(const std::string& filename, const std::vector<ByteCode>& code, const SourceKey& key,
+        std::optional<std::string_view> source_text)
+    {
+        auto image = serialize_byte_code(code, key, true, source_text);
+
+        // Write to a temporary file first so that a concurrent run never sees a partial file.
+        auto temp_filename = filename + ".tmp";
+        {
+            std::ofstream fp(temp_filename, std::ios::out | std::ios::binary | std::ios::trunc);
+            if (!fp.is_open() || !fp.write(image.data(), image.size()))
+            {
+                return false;
+            }
+        }
+
+        std::error_code ec;
+        fs::rename(temp_filename, filename, ec);
+        if (ec)
+        {
+            fs::remove(temp_filename, ec);
+            return false;
+        }
+
+        return true;
+    }
+
+    LoadResult load_byte_code(const std::string& filename, const ParseOptions& parse, const CacheOptions& cache)
+    {
+        LoadResult result;
+
+        SourceText source;
+        if (!read_all_text(filename, source))
+        {
+            throw RuntimeError("Failed to read source file");
+        }
+
+        if (fs::path(filename).extension() == byte_code_extension)
+        {
+            if (!deserialize_byte_code(source.view(), result.code, result.key))
+            {
+                throw RuntimeError("Invalid byte code file");
+            }
+
+            result.from_cache = true;
+            return result;
+        }
+
+        // Parsing with the syntax tree or with both lexers is only done to measure or check the parser, so the cache
+        // is skipped for them.
+        auto use_cache = cache.enabled && parse.mode == ParseMode::streaming && parse.lexer != LexerBackend::cross_check;
+        result.key = make_source_key(source.view());
+        auto cache_path = fs::path(cache.directory) / fmt::format("{:016x}{}", result.key.hash, byte_code_extension);
+
+        if (use_cache && read_cache_entry(cache_path, source.view(), result.code))
+        {
+            result.from_cache = true;
+            return result;
+        }
+
+        result.code = interpret_source(source.view(), parse);
+
+        if (use_cache)
+        {
+            // Failing to write the cache only costs a parse on the next run.
+            std::error_code ec;
+            fs::create_directories(cache.directory, ec);
+            if (!ec)
+            {
+                write_byte_code_file(cache_path.string(), result.code, result.key, source.view());
+            }
+        }
+
+        return result;
+    }
+
+    static bool read_cache_entry(const fs::path& path, std::string_view source, std::vector<ByteCode>& result)
+    {
+        std::error_code ec;
+        if (!fs::exists(path, ec))
+        {
+            return false;
+        }
+
+        SourceText image;
+        if (!read_all_text(path.string(), image))
+        {
+            return false;
+        }
+
+        // The file name is only a hash of the source, so the entry is used only if it holds the very same source.
+        SourceKey image_key;
+        std::optional<std::string_view> image_source;
+        if (!deserialize_byte_code(image.view(), result, image_key, &image_source))
+        {
+            return false;
+        }
+
+        return image_source && *image_source == source;
+    }
+
+    static bool is_parser_op_code(std::uint32_t op_code)
+    {
+        switch ((OpCode)op_code)
+        {
+        case OpCode::label:
+        case OpCode::push0:
+        case OpCode::pop:
+        case OpCode::bump:
+        case OpCode::func:
+        case OpCode::jump:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    static std::uint64_t hash_bytes(const char* data, std::size_t size)
+    {
+        // FNV-1a style mixing over 8 byte words, which keeps hashing large sources cheap next to parsing them.
+        constexpr std::uint64_t prime = 1099511628211ull;
+        std::uint64_t hash = 14695981039346656037ull ^ size;
+
+        std::size_t i = 0;
+        for (; i + sizeof(std::uint64_t) <= size; i += sizeof(std::uint64_t))
+        {
+            std::uint64_t word;
+            std::memcpy(&word, data + i, sizeof(word));
+
+            hash = (hash ^ word) * prime;
+            hash ^= hash >> 29;
+        }
+
+        for (; i < size; ++i)
+        {
+            hash = (hash ^ (unsigned char)data[i]) * prime;
+        }
+
+        return hash;
+    }
+}
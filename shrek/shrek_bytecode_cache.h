@@ -0,0 +1,59 @@
+#ifndef _SHREK_BYTECODE_CACHE_H_INCLUDE_GUARD
+#define _SHREK_BYTECODE_CACHE_H_INCLUDE_GUARD
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "shrek_parser.h"
+#include "shrek_types.h"
+
+namespace shrek
+{
+    // Extension of precompiled byte code files. A code file with this extension is loaded as byte code instead of
+    // being parsed.
+    constexpr auto byte_code_extension = ".shrekc";
+
+    struct CacheOptions
+    {
+        bool enabled = true;
+        std::string directory = ".shrek_cache";
+    };
+
+    // Identifies the source a byte code image was compiled from.
+    struct SourceKey
+    {
+        std::uint64_t hash = 0;
+        std::uint64_t size = 0;
+    };
+
+    struct LoadResult
+    {
+        std::vector<ByteCode> code;
+        SourceKey key;
+        bool from_cache = false;
+    };
+
+    SourceKey make_source_key(std::string_view source);
+
+    // Build a .shrekc image. The source index side table is optional and only used for diagnostics. The source text is
+    // stored in cache entries, so a hash collision cannot pass one program off as another.
+    std::string serialize_byte_code(const std::vector<ByteCode>& code, const SourceKey& key, bool include_source_index,
+        std::optional<std::string_view> source_text = std::nullopt);
+
+    // Read a .shrekc image. Returns false if the image is truncated, corrupt or from another format version. The
+    // source text is set to a view into the image if the image holds it.
+    bool deserialize_byte_code(std::string_view image, std::vector<ByteCode>& result, SourceKey& key,
+        std::optional<std::string_view>* source_text = nullptr);
+
+    bool write_byte_code_file(const std::string& filename, const std::vector<ByteCode>& code, const SourceKey& key,
+        std::optional<std::string_view> source_text = std::nullopt);
+
+    // Get the parsed byte code for a code file. Parsed code is stored in the cache directory under the hash of the
+    // source, along with the source itself, and reused while the source is unchanged. Stale or corrupt entries, and
+    // entries for another source with the same hash, are replaced by parsing again.
+    LoadResult load_byte_code(const std::string& filename, const ParseOptions& parse, const CacheOptions& cache);
+}
+
+#endif // _SHREK_BYTECODE_CACHE_H_INCLUDE_GUARD
@@ -0,0 +1,327 @@
+#include "shrek_cfg.h"
+
+#include <fstream>
+#include "fmt/format.h"
+
+#include "shrek_disassembler.h"
+
+namespace shrek
+{
+    static std::size_t first_instruction(const ControlFlowGraph& cfg, const std::vector<ByteCode>& code,
+        std::size_t block);
+
+    std::size_t ControlFlowGraph::label_block(int label) const
+    {
+        if (label < 0 || (std::size_t)label >= label_blocks.size())
+        {
+            return exit_block;
+        }
+
+        return label_blocks[label];
+    }
+
+    ControlFlowGraph build_cfg(const std::vector<ByteCode>& code)
+    {
+        ControlFlowGraph cfg;
+
+        for (std::size_t i = 0; i < code.size(); ++i)
+        {
+            const auto& byte = code[i];
+
+            if (cfg.blocks.empty() || byte.op_code == OpCode::label || is_jump(code[i - 1].op_code))
+            {
+                BasicBlock block;
+                block.begin = i;
+                cfg.blocks.push_back(block);
+            }
+
+            cfg.blocks.back().end = i + 1;
+
+            if (byte.op_code == OpCode::label)
+            {
+                if ((std::size_t)byte.a >= cfg.label_blocks.size())
+                {
+                    cfg.label_blocks.resize((std::size_t)byte.a + 1, exit_block);
+                }
+
+                cfg.label_blocks[byte.a] = cfg.blocks.size() - 1;
+            }
+        }
+
+        for (std::size_t i = 0; i < cfg.blocks.size(); ++i)
+        {
+            auto& block = cfg.blocks[i];
+            const auto& last = code[block.end - 1];
+
+            if (is_jump(last.op_code))
+            {
+                block.jump_target = cfg.label_block(last.a);
+            }
+
+            if (last.op_code != OpCode::jmp)
+            {
+                block.next = i + 1 < cfg.blocks.size() ? i + 1 : exit_block;
+            }
+        }
+
+        return cfg;
+    }
+
+    std::size_t remove_unreachable_blocks(std::vector<ByteCode>& code)
+    {
+        auto cfg = build_cfg(code);
+        if (cfg.blocks.empty())
+        {
+            return 0;
+        }
+
+        std::vector<bool> reachable(cfg.blocks.size(), false);
+        std::vector<std::size_t> pending = { 0 };
+        reachable[0] = true;
+
+        while (!pending.empty())
+        {
+            const auto& block = cfg.blocks[pending.back()];
+            pending.pop_back();
+
+            for (auto successor : { block.jump_target, block.next })
+            {
+                if (successor < cfg.blocks.size() && !reachable[successor])
+                {
+                    reachable[successor] = true;
+                    pending.push_back(successor);
+                }
+            }
+        }
+
+        // Blocks keep their order, so each reachable block still falls through to the same block.
+        std::size_t write = 0;
+        for (std::size_t i = 0; i < cfg.blocks.size(); ++i)
+        {
+            if (!reachable[i])
+            {
+                continue;
+            }
+
+            for (auto read = cfg.blocks[i].begin; read < cfg.blocks[i].end; ++read)
+            {
+                code[write++] = code[read];
+            }
+        }
+
+        auto removed = code.size() - write;
+        code.resize(write);
+
+        return removed;
+    }
+
+    std::size_t thread_jumps(std::vector<ByteCode>& code)
+    {
+        auto cfg = build_cfg(code);
+        std::size_t threaded = 0;
+
+        // Label each chain of jumps from a label ends at, for jz, jneg and the other jumps, which only follow jmp.
+        // Filled in as chains are followed, so long chains are not walked again from every jump into them.
+        std::vector<int> chain_ends[3];
+        for (auto& ends : chain_ends)
+        {
+            ends.resize(cfg.label_blocks.size(), -1);
+        }
+
+        std::vector<int> chain;
+
+        for (const auto& block : cfg.blocks)
+        {
+            auto& jump = code[block.end - 1];
+            if (!is_jump(jump.op_code))
+            {
+                continue;
+            }
+
+            auto& ends = chain_ends[jump.op_code == OpCode::jz ? 1 : jump.op_code == OpCode::jneg ? 2 : 0];
+            chain.clear();
+
+            // Each hop moves to another block, so a chain longer than the block count is a loop of jumps.
+            auto target = jump.a;
+            for (std::size_t hops = 0; hops < cfg.blocks.size(); ++hops)
+            {
+                if (target >= 0 && (std::size_t)target < ends.size() && ends[target] >= 0)
+                {
+                    target = ends[target];
+                    break;
+                }
+
+                auto index = first_instruction(cfg, code, cfg.label_block(target));
+                if (index == no_block)
+                {
+                    break;
+                }
+
+                // A jz or jneg that was taken leaves {1} as it was, so one of the same kind at the target is taken too.
+                const auto& next = code[index];
+                if (next.op_code != OpCode::jmp
+                    && !(next.op_code == jump.op_code && (next.op_code == OpCode::jz || next.op_code == OpCode::jneg)))
+                {
+                    break;
+                }
+
+                if (next.a == target)
+                {
+                    break;
+                }
+
+                chain.push_back(target);
+                target = next.a;
+            }
+
+            for (auto label : chain)
+            {
+                if (label >= 0 && (std::size_t)label < ends.size())
+                {
+                    ends[label] = target;
+                }
+            }
+
+            if (target != jump.a)
+            {
+                jump.a = target;
+                ++threaded;
+            }
+        }
+
+        return threaded;
+    }
+
+    std::size_t remove_unused_labels(std::vector<ByteCode>& code)
+    {
+        std::vector<bool> targeted;
+        std::vector<std::size_t> last_definition;
+
+        for (std::size_t i = 0; i < code.size(); ++i)
+        {
+            const auto& byte = code[i];
+            if (!is_jump(byte.op_code) && byte.op_code != OpCode::label)
+            {
+                continue;
+            }
+
+            if ((std::size_t)byte.a >= targeted.size())
+            {
+                targeted.resize((std::size_t)byte.a + 1, false);
+                last_definition.resize((std::size_t)byte.a + 1, no_block);
+            }
+
+            if (byte.op_code == OpCode::label)
+            {
+                last_definition[byte.a] = i;
+            }
+            else
+            {
+                targeted[byte.a] = true;
+            }
+        }
+
+        std::size_t write = 0;
+        for (std::size_t read = 0; read < code.size(); ++read)
+        {
+            const auto& byte = code[read];
+            if (byte.op_code == OpCode::label && (!targeted[byte.a] || last_definition[byte.a] != read))
+            {
+                continue;
+            }
+
+            code[write++] = byte;
+        }
+
+        auto removed = code.size() - write;
+        code.resize(write);
+
+        return removed;
+    }
+
+    std::string cfg_to_dot(const std::vector<ByteCode>& code)
+    {
+        auto cfg = build_cfg(code);
+        fmt::memory_buffer out;
+
+        fmt::format_to(out, "digraph cfg\n{{\n");
+        fmt::format_to(out, "    node [shape=box, fontname=\"monospace\"];\n");
+        fmt::format_to(out, "    exit [shape=oval];\n");
+
+        for (std::size_t i = 0; i < cfg.blocks.size(); ++i)
+        {
+            const auto& block = cfg.blocks[i];
+
+            // Left justified lines, so the block reads like the disassembly.
+            fmt::format_to(out, "    b{} [label=\"b{}\\l", i, i);
+            for (auto index = block.begin; index < block.end; ++index)
+            {
+                const auto& byte = code[index];
+                fmt::format_to(out, "{:>6}  {}", index, op_code_name(byte.op_code));
+                if (has_operand(byte.op_code))
+                {
+                    fmt::format_to(out, " {}", operand_text(byte));
+                }
+
+                fmt::format_to(out, "\\l");
+            }
+
+            fmt::format_to(out, "\"];\n");
+        }
+
+        for (std::size_t i = 0; i < cfg.blocks.size(); ++i)
+        {
+            const auto& block = cfg.blocks[i];
+
+            if (block.jump_target != no_block)
+            {
+                auto target = block.jump_target == exit_block ? std::string("exit") : fmt::format("b{}", block.jump_target);
+                fmt::format_to(out, "    b{} -> {} [label=\"jump\"];\n", i, target);
+            }
+
+            if (block.next != no_block)
+            {
+                auto target = block.next == exit_block ? std::string("exit") : fmt::format("b{}", block.next);
+                fmt::format_to(out, "    b{} -> {};\n", i, target);
+            }
+        }
+
+        if (cfg.blocks.empty())
+        {
+            fmt::format_to(out, "    entry [shape=oval];\n    entry -> exit;\n");
+        }
+
+        fmt::format_to(out, "}}\n");
+
+        return fmt::to_string(out);
+    }
+
+    bool write_cfg_file(const std::string& filename, const std::vector<ByteCode>& code)
+    {
+        auto dot = cfg_to_dot(code);
+
+        std::ofstream fp(filename, std::ios::out | std::ios::trunc);
+        return fp.is_open() && fp.write(dot.data(), dot.size());
+    }
+
+    // Index of the first instruction that is not a label, starting at the given block and following fall through, or
+    // no_block if the program exits first.
+    static std::size_t first_instruction(const ControlFlowGraph& cfg, const std::vector<ByteCode>& code,
+        std::size_t block)
+    {
+        for (std::size_t hops = 0; block < cfg.blocks.size() && hops < cfg.blocks.size(); ++hops)
+        {
+            for (auto index = cfg.blocks[block].begin; index < cfg.blocks[block].end; ++index)
+            {
+                if (code[index].op_code != OpCode::label)
+                {
+                    return index;
+                }
+            }
+
+            block = cfg.blocks[block].next;
+        }
+
+        return no_block;
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef _SHREK_CFG_H_INCLUDE_GUARD
+#define _SHREK_CFG_H_INCLUDE_GUARD
+
+#include <limits>
+#include <string>
+
+#include "shrek_types.h"
+
+namespace shrek
+{
+    // Successor of a block that is not there, such as the fall through of an unconditional jump.
+    constexpr std::size_t no_block = std::numeric_limits<std::size_t>::max();
+
+    // Successor of a block that leaves the program, either by running off the end or by jumping to an undefined label.
+    constexpr std::size_t exit_block = no_block - 1;
+
+    // Instructions [begin, end) of the code. A block is only entered at begin and only left after its last instruction.
+    struct BasicBlock
+    {
+        std::size_t begin = 0;
+        std::size_t end = 0;
+
+        // Block the jump ending this block lands on, or no_block if the block does not end with a jump.
+        std::size_t jump_target = no_block;
+
+        // Block run next if the block does not jump, or no_block if the block ends with an unconditional jump.
+        std::size_t next = no_block;
+    };
+
+    // Control flow graph of code that is not linked yet, so jumps hold label numbers and labels are instructions. Every
+    // label starts a block and every jump ends one.
+    struct ControlFlowGraph
+    {
+        std::vector<BasicBlock> blocks;
+
+        // Block a jump to each label number lands on. A label defined more than once lands on its last definition, the
+        // same as the linker. Undefined labels land on exit_block.
+        std::vector<std::size_t> label_blocks;
+
+        std::size_t label_block(int label) const;
+    };
+
+    ControlFlowGraph build_cfg(const std::vector<ByteCode>& code);
+
+    // Remove blocks that cannot be reached from the first instruction. Returns the number of instructions removed.
+    std::size_t remove_unreachable_blocks(std::vector<ByteCode>& code);
+
+    // Retarget jumps that land on a jmp, or on a jz or jneg of the same kind as the jump, to that jump's label. Returns
+    // the number of jumps retargeted.
+    std::size_t thread_jumps(std::vector<ByteCode>& code);
+
+    // Remove labels that no jump targets, and definitions overridden by a later definition of the same label. Returns
+    // the number of labels removed.
+    std::size_t remove_unused_labels(std::vector<ByteCode>& code);
+
+    // Graphviz digraph of the control flow graph, with the instructions of each block.
+    std::string cfg_to_dot(const std::vector<ByteCode>& code);
+
+    // Write cfg_to_dot of the code to a file. Returns false if the file could not be written.
+    bool write_cfg_file(const std::string& filename, const std::vector<ByteCode>& code);
+}
+
+#endif // _SHREK_CFG_H_INCLUDE_GUARD
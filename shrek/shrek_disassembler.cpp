@@ -0,0 +1,158 @@
+#include "shrek_disassembler.h"
+
+#include "fmt/format.h"
+
+namespace shrek
+{
+    const char* op_code_name(OpCode op_code)
+    {
+        switch (op_code)
+        {
+        case OpCode::no_op:
+            return "no_op";
+        case OpCode::label:
+            return "label";
+        case OpCode::push0:
+            return "push0";
+        case OpCode::pop:
+            return "pop";
+        case OpCode::bump:
+            return "bump";
+        case OpCode::func:
+            return "func";
+        case OpCode::jump:
+            return "jump";
+        case OpCode::jmp:
+            return "jmp";
+        case OpCode::jz:
+            return "jz";
+        case OpCode::jneg:
+            return "jneg";
+        case OpCode::push_const:
+            return "push_const";
+        case OpCode::add_const:
+            return "add_const";
+        case OpCode::call_direct:
+            return "call_direct";
+        case OpCode::call_fast:
+            return "call_fast";
+        case OpCode::input:
+            return "input";
+        case OpCode::output:
+            return "output";
+        case OpCode::add:
+            return "add";
+        case OpCode::subtract:
+            return "subtract";
+        case OpCode::multiply:
+            return "multiply";
+        case OpCode::divide:
+            return "divide";
+        case OpCode::mod:
+            return "mod";
+        case OpCode::double_:
+            return "double";
+        case OpCode::negate:
+            return "negate";
+        case OpCode::clone:
+            return "clone";
+        case OpCode::pop_unchecked:
+            return "pop_unchecked";
+        case OpCode::bump_unchecked:
+            return "bump_unchecked";
+        case OpCode::add_const_unchecked:
+            return "add_const_unchecked";
+        case OpCode::jz_unchecked:
+            return "jz_unchecked";
+        case OpCode::jneg_unchecked:
+            return "jneg_unchecked";
+        case OpCode::add_unchecked:
+            return "add_unchecked";
+        case OpCode::subtract_unchecked:
+            return "subtract_unchecked";
+        case OpCode::multiply_unchecked:
+            return "multiply_unchecked";
+        case OpCode::reg_set:
+            return "reg_set";
+        case OpCode::reg_move:
+            return "reg_move";
+        case OpCode::reg_add:
+            return "reg_add";
+        case OpCode::reg_add_imm:
+            return "reg_add_imm";
+        case OpCode::reg_sub:
+            return "reg_sub";
+        case OpCode::reg_rsub_imm:
+            return "reg_rsub_imm";
+        case OpCode::reg_mul:
+            return "reg_mul";
+        case OpCode::reg_mul_imm:
+            return "reg_mul_imm";
+        case OpCode::reg_jz:
+            return "reg_jz";
+        case OpCode::reg_jneg:
+            return "reg_jneg";
+        case OpCode::reg_sync:
+            return "reg_sync";
+        case OpCode::superinstruction:
+            return "super";
+        case OpCode::halt:
+            return "halt";
+        }
+
+        return "unknown";
+    }
+
+    bool has_operand(OpCode op_code)
+    {
+        return is_jump(op_code) || op_code == OpCode::label || op_code == OpCode::push_const
+            || op_code == OpCode::add_const || op_code == OpCode::add_const_unchecked || op_code == OpCode::call_direct
+            || op_code == OpCode::call_fast || is_register_op(op_code) || op_code == OpCode::superinstruction;
+    }
+
+    std::string operand_text(const ByteCode& code)
+    {
+        switch (code.op_code)
+        {
+        case OpCode::reg_set:
+        case OpCode::reg_jz:
+        case OpCode::reg_jneg:
+            return fmt::format("r{}, {}", code.b, code.a);
+        case OpCode::reg_move:
+            return fmt::format("r{}, r{}", code.b, code.c);
+        case OpCode::reg_add:
+        case OpCode::reg_sub:
+        case OpCode::reg_mul:
+            return fmt::format("r{}, r{}, r{}", code.b, code.c, code.a);
+        case OpCode::reg_add_imm:
+        case OpCode::reg_rsub_imm:
+        case OpCode::reg_mul_imm:
+            return fmt::format("r{}, r{}, {}", code.b, code.c, code.a);
+        case OpCode::superinstruction:
+            return fmt::format("s{}, {}, {}", code.b, code.c, code.a);
+        default:
+            break;
+        }
+
+        if (has_operand(code.op_code))
+        {
+            return fmt::format("{}", code.a);
+        }
+
+        return {};
+    }
+
+    std::string disassemble(const std::vector<ByteCode>& code)
+    {
+        fmt::memory_buffer out;
+
+        for (std::size_t i = 0; i < code.size(); ++i)
+        {
+            const auto& byte = code[i];
+            fmt::format_to(out, "{:>8}  {:<20}{:<10}", i, op_code_name(byte.op_code), operand_text(byte));
+            fmt::format_to(out, "  # source index {}\n", byte.source_code_index);
+        }
+
+        return fmt::to_string(out);
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef _SHREK_DISASSEMBLER_H_INCLUDE_GUARD
+#define _SHREK_DISASSEMBLER_H_INCLUDE_GUARD
+
+#include <string>
+
+#include "shrek_types.h"
+
+namespace shrek
+{
+    const char* op_code_name(OpCode op_code);
+
+    // True if the op code uses the a field of ByteCode.
+    bool has_operand(OpCode op_code);
+
+    // Operands of an instruction as shown in listings, with registers as r<n>. Empty if it has none.
+    std::string operand_text(const ByteCode& code);
+
+    // Text listing of byte code, one instruction per line. Jump operands are shown as is, so they are label numbers
+    // before the code is linked and byte code positions after.
+    std::string disassemble(const std::vector<ByteCode>& code);
+}
+
+#endif // _SHREK_DISASSEMBLER_H_INCLUDE_GUARD
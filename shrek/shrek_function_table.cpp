@@ -0,0 +1,65 @@
+#include "shrek_function_table.h"
+
+namespace shrek
+{
+    FunctionTable::FunctionTable()
+        : m_dense(default_dense_size)
+    {
+
+    }
+
+    void FunctionTable::set_dense_size(std::size_t dense_size)
+    {
+        if (dense_size == m_dense.size())
+        {
+            return;
+        }
+
+        std::vector<std::pair<int, FunctionEntry>> registered(m_sparse.begin(), m_sparse.end());
+        for (std::size_t i = 0; i < m_dense.size(); ++i)
+        {
+            if (is_registered(m_dense[i]))
+            {
+                registered.emplace_back((int)i, m_dense[i]);
+            }
+        }
+
+        m_dense.assign(dense_size, FunctionEntry());
+        m_sparse.clear();
+
+        for (const auto& entry : registered)
+        {
+            add(entry.first, entry.second);
+        }
+    }
+
+    bool FunctionTable::add(int func_number, const FunctionEntry& entry)
+    {
+        if (!is_registered(entry) || find(func_number))
+        {
+            return false;
+        }
+
+        if ((std::size_t)(unsigned)func_number < m_dense.size())
+        {
+            m_dense[(unsigned)func_number] = entry;
+        }
+        else
+        {
+            m_sparse[func_number] = entry;
+        }
+
+        return true;
+    }
+
+    const FunctionEntry* FunctionTable::find_sparse(int func_number) const
+    {
+        if (m_sparse.empty())
+        {
+            return nullptr;
+        }
+
+        auto it = m_sparse.find(func_number);
+        return it != m_sparse.end() ? &it->second : nullptr;
+    }
+}
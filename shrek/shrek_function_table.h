@@ -0,0 +1,59 @@
+#ifndef _SHREK_FUNCTION_TABLE_H_INCLUDE_GUARD
+#define _SHREK_FUNCTION_TABLE_H_INCLUDE_GUARD
+
+#include <unordered_map>
+#include <vector>
+
+#include "shrek.h"
+
+namespace shrek
+{
+    // A registered function. Exactly one of func and fast_func is set. Fast functions declare how many values they take
+    // from the top of the stack and how many they leave in their place.
+    struct FunctionEntry
+    {
+        ShrekFunc func = nullptr;
+        ShrekFastFunc fast_func = nullptr;
+        int arg_count = 0;
+        int result_count = 0;
+    };
+
+    // Registered functions by number. Numbers below the dense size are looked up by index, which covers the built-ins
+    // and typical extension numbers. Anything else, including negative numbers, goes to a hash map. Entries do not move
+    // while the dense size stays the same, so byte code can point at them.
+    class FunctionTable
+    {
+    public:
+        static constexpr std::size_t default_dense_size = 1024;
+
+        FunctionTable();
+
+        // Change how many numbers are looked up by index, keeping the registered functions.
+        void set_dense_size(std::size_t dense_size);
+
+        // Returns false if a function is already registered with the number, or the entry has no function.
+        bool add(int func_number, const FunctionEntry& entry);
+
+        // Function registered with the number, or nullptr if there is none.
+        inline const FunctionEntry* find(int func_number) const
+        {
+            if ((std::size_t)(unsigned)func_number < m_dense.size())
+            {
+                const auto& entry = m_dense[(unsigned)func_number];
+                return is_registered(entry) ? &entry : nullptr;
+            }
+
+            return find_sparse(func_number);
+        }
+
+    private:
+        std::vector<FunctionEntry> m_dense;
+        std::unordered_map<int, FunctionEntry> m_sparse;
+
+        static inline bool is_registered(const FunctionEntry& entry) { return entry.func || entry.fast_func; }
+
+        const FunctionEntry* find_sparse(int func_number) const;
+    };
+}
+
+#endif // _SHREK_FUNCTION_TABLE_H_INCLUDE_GUARD
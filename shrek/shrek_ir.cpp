@@ -0,0 +1,692 @@
+#include "shrek_ir.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "shrek_function_table.h"
+#include "shrek_stack_depth.h"
+
+namespace shrek
+{
+    static IrEffect instruction_effect(const ByteCode& code);
+
+    const IrInstruction& IrProgram::definition(int value) const
+    {
+        const auto& result = values[value];
+        return blocks[result.block].instructions[result.index];
+    }
+
+    // Builds the IR in two steps. Each block is first run on its own, with a placeholder for every value it reads from
+    // the stack it starts with. The placeholders are then found in the predecessors by their position from the top,
+    // adding phis where predecessors merge, the same way as building SSA form for local variables.
+    class IrBuilder
+    {
+    public:
+        explicit IrBuilder(const std::vector<ByteCode>& code);
+
+        IrProgram build();
+
+    private:
+        struct Placeholder
+        {
+            std::size_t block;
+            std::size_t position;
+            int value;
+        };
+
+        struct PendingPhi
+        {
+            std::size_t block;
+            std::size_t phi;
+        };
+
+        const std::vector<ByteCode>& m_code;
+        IrProgram m_program;
+        std::vector<int> m_forward;
+        std::vector<Placeholder> m_placeholders;
+        std::vector<PendingPhi> m_pending_phis;
+
+        // Value at each position from the top at the start of each block, once looked up.
+        std::vector<std::unordered_map<std::size_t, int>> m_entry_values;
+
+        // Positions from the top at the start of each block that can hold a value the IR follows. Below the most values
+        // the stack can hold there, a read always fails. Where there is no such bound, only the values every path
+        // leaves are followed. Either way the slots below are unknown, which also stops a loop that pops more than it
+        // pushes from adding phis ever deeper in the stack.
+        std::vector<std::size_t> m_entry_limits;
+
+        int add_value(IrValueKind kind, std::size_t block, std::size_t index);
+        int resolve(int value);
+
+        void build_block(std::size_t index, const BasicBlock& block);
+        int lookup_entry(std::size_t block, std::size_t position);
+        int lookup_exit(std::size_t block, std::size_t position);
+        void fill_phis();
+        bool remove_trivial_phis();
+        void finish();
+    };
+
+    IrProgram build_ir(const std::vector<ByteCode>& code)
+    {
+        IrBuilder builder(code);
+        return builder.build();
+    }
+
+    IrBuilder::IrBuilder(const std::vector<ByteCode>& code)
+        : m_code(code)
+    {
+    }
+
+    IrProgram IrBuilder::build()
+    {
+        auto cfg = build_cfg(m_code);
+
+        m_program.blocks.resize(cfg.blocks.size());
+        m_program.label_blocks = cfg.label_blocks;
+        m_entry_values.resize(cfg.blocks.size());
+        m_program.values.reserve(m_code.size());
+
+        auto depths = stack_depths(m_code);
+        m_entry_limits.resize(cfg.blocks.size(), 0);
+        for (std::size_t i = 0; i < cfg.blocks.size(); ++i)
+        {
+            const auto& range = depths[cfg.blocks[i].begin];
+            if (range.reached)
+            {
+                m_entry_limits[i] = range.max != unbounded_depth ? range.max : range.min;
+            }
+        }
+
+        m_forward.reserve(m_code.size());
+
+        if (!m_program.blocks.empty())
+        {
+            m_program.blocks[0].predecessors.push_back(no_block);
+        }
+
+        for (std::size_t i = 0; i < cfg.blocks.size(); ++i)
+        {
+            auto& block = m_program.blocks[i];
+            block.jump_target = cfg.blocks[i].jump_target;
+            block.next = cfg.blocks[i].next;
+
+            for (auto successor : { block.jump_target, block.next })
+            {
+                if (successor < cfg.blocks.size())
+                {
+                    m_program.blocks[successor].predecessors.push_back(i);
+                }
+            }
+        }
+
+        for (std::size_t i = 0; i < cfg.blocks.size(); ++i)
+        {
+            build_block(i, cfg.blocks[i]);
+        }
+
+        for (const auto& placeholder : m_placeholders)
+        {
+            auto value = lookup_entry(placeholder.block, placeholder.position);
+            fill_phis();
+
+            if (resolve(value) != placeholder.value)
+            {
+                m_forward[placeholder.value] = value;
+            }
+        }
+
+        while (remove_trivial_phis())
+        {
+        }
+
+        finish();
+
+        return std::move(m_program);
+    }
+
+    int IrBuilder::add_value(IrValueKind kind, std::size_t block, std::size_t index)
+    {
+        IrValue value;
+        value.kind = kind;
+        value.block = block;
+        value.index = index;
+        m_program.values.push_back(value);
+        m_forward.push_back(-1);
+
+        return (int)m_program.values.size() - 1;
+    }
+
+    int IrBuilder::resolve(int value)
+    {
+        auto result = value;
+        while (m_forward[result] >= 0)
+        {
+            result = m_forward[result];
+        }
+
+        // Point the whole chain at the end, so later lookups are one step.
+        while (m_forward[value] >= 0)
+        {
+            auto next = m_forward[value];
+            m_forward[value] = result;
+            value = next;
+        }
+
+        return result;
+    }
+
+    void IrBuilder::build_block(std::size_t index, const BasicBlock& cfg_block)
+    {
+        auto& block = m_program.blocks[index];
+        block.instructions.reserve(cfg_block.end - cfg_block.begin);
+        std::vector<int> stack;
+
+        // Values below this were already passed to a call that may look at the whole stack.
+        std::size_t escaped = 0;
+
+        auto pop = [&]()
+        {
+            if (!stack.empty())
+            {
+                auto value = stack.back();
+                stack.pop_back();
+                escaped = std::min(escaped, stack.size());
+                return value;
+            }
+
+            if (block.unknown_depth)
+            {
+                return add_value(IrValueKind::unknown, index, 0);
+            }
+
+            auto value = add_value(IrValueKind::unknown, index, 0);
+            m_placeholders.push_back({ index, block.entry_popped++, value });
+            return value;
+        };
+
+        for (auto i = cfg_block.begin; i < cfg_block.end; ++i)
+        {
+            const auto& code = m_code[i];
+
+            if (code.op_code == OpCode::label)
+            {
+                block.label = code;
+                continue;
+            }
+
+            IrInstruction instruction;
+            instruction.code = code;
+            instruction.effect = instruction_effect(code);
+
+            std::size_t pops = 0;
+            std::size_t results = 0;
+            std::size_t reads = 0;
+
+            switch (code.op_code)
+            {
+            case OpCode::push0:
+            case OpCode::push_const:
+                results = 1;
+                break;
+            case OpCode::pop:
+            case OpCode::pop_unchecked:
+            case OpCode::func:
+                pops = 1;
+                break;
+            case OpCode::bump:
+            case OpCode::bump_unchecked:
+            case OpCode::add_const:
+            case OpCode::add_const_unchecked:
+            case OpCode::double_:
+            case OpCode::negate:
+                pops = 1;
+                results = 1;
+                break;
+            case OpCode::add:
+            case OpCode::subtract:
+            case OpCode::multiply:
+            case OpCode::divide:
+            case OpCode::mod:
+            case OpCode::add_unchecked:
+            case OpCode::subtract_unchecked:
+            case OpCode::multiply_unchecked:
+                pops = 2;
+                results = 1;
+                break;
+            case OpCode::jump:
+                // Jump types 1 and 2 read the value below the type.
+                pops = 1;
+                reads = 1;
+                break;
+            case OpCode::jz:
+            case OpCode::jneg:
+            case OpCode::jz_unchecked:
+            case OpCode::jneg_unchecked:
+            case OpCode::output:
+            case OpCode::clone:
+                reads = 1;
+                results = code.op_code == OpCode::clone ? 1 : 0;
+                break;
+            case OpCode::call_fast:
+                pops = (std::size_t)code.function->arg_count;
+                results = (std::size_t)code.function->result_count;
+                break;
+            default:
+                break;
+            }
+
+            instruction.pops.resize(pops);
+            for (std::size_t n = pops; n > 0; --n)
+            {
+                instruction.pops[n - 1] = pop();
+            }
+
+            for (std::size_t n = 0; n < reads; ++n)
+            {
+                auto value = pop();
+                instruction.reads.push_back(value);
+                stack.push_back(value);
+            }
+
+            if (code.op_code == OpCode::func || code.op_code == OpCode::call_direct
+                || code.op_code == OpCode::call_fast)
+            {
+                instruction.escapes.assign(stack.begin() + (std::ptrdiff_t)escaped, stack.end());
+                escaped = stack.size();
+            }
+
+            if (instruction.effect == IrEffect::unknown_depth)
+            {
+                // Nothing below is known once the instruction has run.
+                stack.clear();
+                escaped = 0;
+                block.unknown_depth = true;
+            }
+
+            auto instruction_index = block.instructions.size();
+            for (std::size_t n = 0; n < results; ++n)
+            {
+                auto value = add_value(IrValueKind::result, index, instruction_index);
+                instruction.results.push_back(value);
+                stack.push_back(value);
+            }
+
+            block.instructions.push_back(std::move(instruction));
+        }
+
+        block.exit_values = std::move(stack);
+    }
+
+    int IrBuilder::lookup_entry(std::size_t block, std::size_t position)
+    {
+        // Follow blocks with a single predecessor without adding phis.
+        std::vector<std::pair<std::size_t, std::size_t>> visited;
+        int value = -1;
+
+        while (true)
+        {
+            auto cached = m_entry_values[block].find(position);
+            if (cached != m_entry_values[block].end())
+            {
+                value = cached->second;
+                break;
+            }
+
+            // Below the entry limit, and in blocks no path from the start reaches, there is no slot to follow.
+            if (position >= m_entry_limits[block])
+            {
+                value = add_value(IrValueKind::unknown, block, 0);
+                m_entry_values[block][position] = value;
+                break;
+            }
+
+            const auto& predecessors = m_program.blocks[block].predecessors;
+            if (predecessors.size() != 1 || predecessors[0] == no_block)
+            {
+                if (predecessors.empty() || (predecessors.size() == 1 && predecessors[0] == no_block))
+                {
+                    value = add_value(IrValueKind::unknown, block, 0);
+                }
+                else
+                {
+                    IrPhi phi;
+                    phi.position = position;
+                    phi.value = add_value(IrValueKind::phi, block, m_program.blocks[block].phis.size());
+                    value = phi.value;
+
+                    m_program.blocks[block].phis.push_back(phi);
+                    m_pending_phis.push_back({ block, m_program.blocks[block].phis.size() - 1 });
+                }
+
+                m_entry_values[block][position] = value;
+                break;
+            }
+
+            visited.emplace_back(block, position);
+
+            auto predecessor = predecessors[0];
+            const auto& pred_block = m_program.blocks[predecessor];
+            if (position < pred_block.exit_values.size())
+            {
+                value = pred_block.exit_values[pred_block.exit_values.size() - 1 - position];
+                break;
+            }
+
+            if (pred_block.unknown_depth)
+            {
+                value = add_value(IrValueKind::unknown, predecessor, 0);
+                break;
+            }
+
+            position = position - pred_block.exit_values.size() + pred_block.entry_popped;
+            block = predecessor;
+        }
+
+        for (const auto& [visited_block, visited_position] : visited)
+        {
+            m_entry_values[visited_block][visited_position] = value;
+        }
+
+        return value;
+    }
+
+    int IrBuilder::lookup_exit(std::size_t block, std::size_t position)
+    {
+        if (block == no_block)
+        {
+            // The program starts with an empty stack, so reading it fails.
+            return add_value(IrValueKind::unknown, 0, 0);
+        }
+
+        const auto& ir_block = m_program.blocks[block];
+        if (position < ir_block.exit_values.size())
+        {
+            return ir_block.exit_values[ir_block.exit_values.size() - 1 - position];
+        }
+
+        if (ir_block.unknown_depth)
+        {
+            return add_value(IrValueKind::unknown, block, 0);
+        }
+
+        return lookup_entry(block, position - ir_block.exit_values.size() + ir_block.entry_popped);
+    }
+
+    void IrBuilder::fill_phis()
+    {
+        // Looking up an operand can add more phis, so they are filled from a work list instead of recursing.
+        while (!m_pending_phis.empty())
+        {
+            auto pending = m_pending_phis.back();
+            m_pending_phis.pop_back();
+
+            auto predecessors = m_program.blocks[pending.block].predecessors;
+            auto position = m_program.blocks[pending.block].phis[pending.phi].position;
+
+            std::vector<int> incoming;
+            for (auto predecessor : predecessors)
+            {
+                incoming.push_back(lookup_exit(predecessor, position));
+            }
+
+            m_program.blocks[pending.block].phis[pending.phi].incoming = std::move(incoming);
+        }
+    }
+
+    bool IrBuilder::remove_trivial_phis()
+    {
+        bool changed = false;
+
+        for (auto& block : m_program.blocks)
+        {
+            for (auto& phi : block.phis)
+            {
+                if (m_forward[phi.value] >= 0)
+                {
+                    continue;
+                }
+
+                // A phi that only merges itself with one other value is that value.
+                int same = -1;
+                bool trivial = true;
+                for (auto incoming : phi.incoming)
+                {
+                    incoming = resolve(incoming);
+                    if (incoming == phi.value || incoming == same)
+                    {
+                        continue;
+                    }
+
+                    if (same >= 0)
+                    {
+                        trivial = false;
+                        break;
+                    }
+
+                    same = incoming;
+                }
+
+                if (trivial && same >= 0)
+                {
+                    m_forward[phi.value] = same;
+                    changed = true;
+                }
+            }
+        }
+
+        return changed;
+    }
+
+    void IrBuilder::finish()
+    {
+        auto resolve_all = [&](std::vector<int>& values)
+        {
+            for (auto& value : values)
+            {
+                value = resolve(value);
+            }
+        };
+
+        for (std::size_t b = 0; b < m_program.blocks.size(); ++b)
+        {
+            auto& block = m_program.blocks[b];
+
+            std::vector<IrPhi> phis;
+            for (auto& phi : block.phis)
+            {
+                if (m_forward[phi.value] >= 0)
+                {
+                    continue;
+                }
+
+                resolve_all(phi.incoming);
+                m_program.values[phi.value].index = phis.size();
+                phis.push_back(std::move(phi));
+            }
+
+            block.phis = std::move(phis);
+
+            for (auto& instruction : block.instructions)
+            {
+                resolve_all(instruction.pops);
+                resolve_all(instruction.reads);
+                resolve_all(instruction.escapes);
+            }
+
+            resolve_all(block.exit_values);
+        }
+
+        for (auto& block : m_program.blocks)
+        {
+            for (const auto& phi : block.phis)
+            {
+                for (auto incoming : phi.incoming)
+                {
+                    ++m_program.values[incoming].uses;
+                }
+            }
+
+            for (const auto& instruction : block.instructions)
+            {
+                for (const auto* values : { &instruction.pops, &instruction.reads, &instruction.escapes })
+                {
+                    for (auto value : *values)
+                    {
+                        ++m_program.values[value].uses;
+                    }
+                }
+            }
+        }
+    }
+
+    std::vector<ByteCode> lower_ir(const IrProgram& program)
+    {
+        std::vector<ByteCode> code;
+
+        std::size_t size = 0;
+        for (const auto& block : program.blocks)
+        {
+            size += block.instructions.size() + (block.label ? 1 : 0);
+        }
+        code.reserve(size);
+
+        for (const auto& block : program.blocks)
+        {
+            if (block.label)
+            {
+                code.push_back(*block.label);
+            }
+
+            for (const auto& instruction : block.instructions)
+            {
+                if (!instruction.removed)
+                {
+                    code.push_back(instruction.code);
+                }
+            }
+        }
+
+        return code;
+    }
+
+    bool is_removable(const IrProgram& program, int value, std::size_t block, std::size_t index)
+    {
+        const auto& ir_value = program.values[value];
+        if (ir_value.kind != IrValueKind::result || ir_value.block != block || ir_value.index >= index
+            || ir_value.uses != 1)
+        {
+            return false;
+        }
+
+        const auto& instruction = program.definition(value);
+        if (instruction.removed || instruction.effect != IrEffect::pure || instruction.results.size() != 1)
+        {
+            return false;
+        }
+
+        for (auto pop : instruction.pops)
+        {
+            if (!is_removable(program, pop, block, ir_value.index))
+            {
+                return false;
+            }
+        }
+
+        // A clone of a value that may not be on the stack fails, so it has to stay.
+        for (auto read : instruction.reads)
+        {
+            if (program.values[read].kind != IrValueKind::result)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    std::size_t remove_value(IrProgram& program, int value)
+    {
+        const auto& ir_value = program.values[value];
+        auto& instruction = program.blocks[ir_value.block].instructions[ir_value.index];
+
+        remove_instruction(program, instruction);
+
+        std::size_t removed = 1;
+        for (auto pop : instruction.pops)
+        {
+            removed += remove_value(program, pop);
+        }
+
+        return removed;
+    }
+
+    void remove_instruction(IrProgram& program, IrInstruction& instruction)
+    {
+        instruction.removed = true;
+
+        for (const auto* values : { &instruction.pops, &instruction.reads, &instruction.escapes })
+        {
+            for (auto value : *values)
+            {
+                --program.values[value].uses;
+            }
+        }
+    }
+
+    void remove_edge(IrProgram& program, std::size_t from, std::size_t to)
+    {
+        auto& block = program.blocks[to];
+
+        auto predecessor = std::find(block.predecessors.begin(), block.predecessors.end(), from);
+        if (predecessor == block.predecessors.end())
+        {
+            return;
+        }
+
+        auto index = predecessor - block.predecessors.begin();
+        block.predecessors.erase(predecessor);
+
+        for (auto& phi : block.phis)
+        {
+            --program.values[phi.incoming[index]].uses;
+            phi.incoming.erase(phi.incoming.begin() + index);
+        }
+    }
+
+    static IrEffect instruction_effect(const ByteCode& code)
+    {
+        switch (code.op_code)
+        {
+        case OpCode::no_op:
+        case OpCode::push0:
+        case OpCode::push_const:
+        case OpCode::pop:
+        case OpCode::pop_unchecked:
+        case OpCode::bump:
+        case OpCode::bump_unchecked:
+        case OpCode::add_const:
+        case OpCode::add_const_unchecked:
+        case OpCode::add:
+        case OpCode::subtract:
+        case OpCode::multiply:
+        case OpCode::add_unchecked:
+        case OpCode::subtract_unchecked:
+        case OpCode::multiply_unchecked:
+        case OpCode::double_:
+        case OpCode::negate:
+        case OpCode::clone:
+            return IrEffect::pure;
+        case OpCode::func:
+        case OpCode::call_direct:
+        case OpCode::input:
+            return IrEffect::unknown_depth;
+        default:
+            if (is_register_op(code.op_code))
+            {
+                return IrEffect::unknown_depth;
+            }
+
+            return IrEffect::side_effect;
+        }
+    }
+}
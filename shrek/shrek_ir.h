@@ -0,0 +1,137 @@
+#ifndef _SHREK_IR_H_INCLUDE_GUARD
+#define _SHREK_IR_H_INCLUDE_GUARD
+
+#include <optional>
+
+#include "shrek_cfg.h"
+#include "shrek_types.h"
+
+namespace shrek
+{
+    enum class IrValueKind
+    {
+        // Pushed by an instruction.
+        result,
+
+        // Stack slot at the start of a block with more than one predecessor, merged from the value each predecessor
+        // leaves there.
+        phi,
+
+        // Value the IR cannot follow back to where it was pushed, such as one below the values a call to an extension
+        // function or input left, or one read from an empty stack.
+        unknown
+    };
+
+    // An SSA value. Stack slots are not variables of their own: a value is named by the instruction that pushed it, and
+    // a slot read at the start of a block is found by its position from the top of the stack in each predecessor.
+    struct IrValue
+    {
+        IrValueKind kind = IrValueKind::unknown;
+        std::size_t block = 0;
+
+        // Instruction in the block that pushed a result, or the phi's index in the block.
+        std::size_t index = 0;
+
+        // Instructions and phis that read the value, counting instructions that may see the whole stack.
+        std::size_t uses = 0;
+    };
+
+    // How much of an instruction the IR can see through.
+    enum class IrEffect
+    {
+        // Only pops, reads and pushes the values listed, and cannot fail once they are on the stack.
+        pure,
+
+        // Also has an effect outside the stack, or can fail, so it always stays. Function calls with a declared arity
+        // are here, and may see the whole stack.
+        side_effect,
+
+        // Leaves a number of values on the stack that is not known, so values below it are unknown after it. Calls to
+        // functions without a declared arity and input.
+        unknown_depth
+    };
+
+    struct IrInstruction
+    {
+        // Byte code the instruction lowers to. Passes change it in place.
+        ByteCode code;
+        IrEffect effect = IrEffect::pure;
+
+        // Values popped and pushed, bottom to top, and values read from the top without popping them.
+        std::vector<int> pops;
+        std::vector<int> results;
+        std::vector<int> reads;
+
+        // Values below the instruction that a call may look at through the C API.
+        std::vector<int> escapes;
+
+        // Left out when lowering.
+        bool removed = false;
+    };
+
+    struct IrPhi
+    {
+        int value = 0;
+
+        // Position from the top of the stack at the start of the block.
+        std::size_t position = 0;
+
+        // Value each predecessor leaves at that position, in the order of IrBlock::predecessors.
+        std::vector<int> incoming;
+    };
+
+    struct IrBlock
+    {
+        // Label the block starts with, put back when lowering.
+        std::optional<ByteCode> label;
+
+        std::vector<IrPhi> phis;
+        std::vector<IrInstruction> instructions;
+
+        // Successors as in BasicBlock, and predecessors in the order phi operands are listed in. The first block is
+        // also entered from the start of the program, with an empty stack, listed as no_block.
+        std::size_t jump_target = no_block;
+        std::size_t next = no_block;
+        std::vector<std::size_t> predecessors;
+
+        // Values the block leaves on top of the stack, bottom to top. Below them is the stack the block started with,
+        // less the values it popped from it, unless the block has an instruction of unknown_depth.
+        std::vector<int> exit_values;
+        std::size_t entry_popped = 0;
+        bool unknown_depth = false;
+    };
+
+    // SSA form of code that is not linked yet. Blocks are the blocks of the control flow graph, in code order.
+    struct IrProgram
+    {
+        std::vector<IrBlock> blocks;
+        std::vector<IrValue> values;
+
+        // Block each label number starts, as in ControlFlowGraph.
+        std::vector<std::size_t> label_blocks;
+
+        const IrInstruction& definition(int value) const;
+    };
+
+    IrProgram build_ir(const std::vector<ByteCode>& code);
+
+    // Byte code of the blocks in order, leaving out removed instructions.
+    std::vector<ByteCode> lower_ir(const IrProgram& program);
+
+    // True if the instruction pushing value, and every instruction pushing a value it pops, are pure, in the given
+    // block before the instruction at index, used once and only read values pushed by an instruction. Removing them
+    // together with the instruction at index that uses value leaves the stack below unchanged on every path.
+    bool is_removable(const IrProgram& program, int value, std::size_t block, std::size_t index);
+
+    // Remove the instructions is_removable checked for value. Returns the number of instructions removed.
+    std::size_t remove_value(IrProgram& program, int value);
+
+    // Remove an instruction, releasing the values it reads. Values it pops must be removed with remove_value.
+    void remove_instruction(IrProgram& program, IrInstruction& instruction);
+
+    // Remove the edge from one block to another from the predecessors of the block it enters, along with the phi
+    // operands coming in over it. The caller clears the successor in the block it leaves.
+    void remove_edge(IrProgram& program, std::size_t from, std::size_t to);
+}
+
+#endif // _SHREK_IR_H_INCLUDE_GUARD
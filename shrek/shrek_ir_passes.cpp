@@ -0,0 +1,559 @@
+#include "shrek_ir_passes.h"
+
+#include <functional>
+#include <limits>
+#include <queue>
+
+namespace shrek
+{
+    std::size_t remove_dead_values(IrProgram& program)
+    {
+        std::size_t removed = 0;
+
+        for (std::size_t b = 0; b < program.blocks.size(); ++b)
+        {
+            auto& block = program.blocks[b];
+
+            for (std::size_t i = 0; i < block.instructions.size(); ++i)
+            {
+                auto& instruction = block.instructions[i];
+                if (instruction.removed
+                    || (instruction.code.op_code != OpCode::pop && instruction.code.op_code != OpCode::pop_unchecked))
+                {
+                    continue;
+                }
+
+                auto value = instruction.pops[0];
+                if (is_removable(program, value, b, i))
+                {
+                    remove_instruction(program, instruction);
+                    removed += 1 + remove_value(program, value);
+                }
+            }
+        }
+
+        return removed;
+    }
+
+    // Arithmetic on constants wraps, the same as the instructions it replaces do in practice.
+    static int wrap_add(int lhs, int rhs) { return (int)((unsigned)lhs + (unsigned)rhs); }
+
+    static int wrap_subtract(int lhs, int rhs) { return (int)((unsigned)lhs - (unsigned)rhs); }
+
+    static int wrap_multiply(int lhs, int rhs) { return (int)((unsigned)lhs * (unsigned)rhs); }
+
+    // What constant propagation knows about a value. Values start as undefined, before anything that defines them is
+    // seen to run, and only move down to constant and then varying.
+    struct ConstantValue
+    {
+        enum class Kind
+        {
+            undefined,
+            constant,
+            varying
+        };
+
+        Kind kind = Kind::undefined;
+        int value = 0;
+
+        static ConstantValue of(int value) { return { Kind::constant, value }; }
+        static ConstantValue varying() { return { Kind::varying, 0 }; }
+
+        bool is_constant() const { return kind == Kind::constant; }
+
+        bool operator==(const ConstantValue& other) const
+        {
+            return kind == other.kind && (kind != Kind::constant || value == other.value);
+        }
+
+        bool operator!=(const ConstantValue& other) const { return !(*this == other); }
+    };
+
+    class ConstantPropagation
+    {
+    public:
+        explicit ConstantPropagation(IrProgram& program);
+
+        std::size_t run();
+
+    private:
+        IrProgram& m_program;
+        std::vector<ConstantValue> m_values;
+
+        // Blocks reached so far, and which edges into each block were taken, in the order of IrBlock::predecessors.
+        std::vector<bool> m_reachable;
+        std::vector<std::vector<bool>> m_edges;
+
+        // Blocks that read each value without defining it, through a phi or from a predecessor.
+        std::vector<std::vector<std::size_t>> m_user_blocks;
+
+        // Blocks to visit, lowest first, so values mostly flow forward and each block is visited few times.
+        std::priority_queue<std::size_t, std::vector<std::size_t>, std::greater<std::size_t>> m_work_list;
+        std::vector<bool> m_queued;
+
+        void queue(std::size_t block);
+        void add_edge(std::size_t from, std::size_t to);
+        void set_value(int value, ConstantValue constant);
+
+        void visit_block(std::size_t block);
+        ConstantValue evaluate(const IrInstruction& instruction) const;
+        void visit_jump(std::size_t block, const IrInstruction& jump);
+
+        std::size_t fold_block(std::size_t block);
+        std::size_t resolve_jump(std::size_t block);
+    };
+
+    std::size_t propagate_constants(IrProgram& program)
+    {
+        ConstantPropagation propagation(program);
+        return propagation.run();
+    }
+
+    ConstantPropagation::ConstantPropagation(IrProgram& program)
+        : m_program(program)
+    {
+    }
+
+    std::size_t ConstantPropagation::run()
+    {
+        const auto& blocks = m_program.blocks;
+        if (blocks.empty())
+        {
+            return 0;
+        }
+
+        m_values.resize(m_program.values.size());
+        m_user_blocks.resize(m_program.values.size());
+        m_reachable.resize(blocks.size());
+        m_edges.resize(blocks.size());
+        m_queued.resize(blocks.size());
+
+        for (std::size_t v = 0; v < m_values.size(); ++v)
+        {
+            if (m_program.values[v].kind == IrValueKind::unknown)
+            {
+                m_values[v] = ConstantValue::varying();
+            }
+        }
+
+        for (std::size_t b = 0; b < blocks.size(); ++b)
+        {
+            const auto& block = blocks[b];
+            m_edges[b].resize(block.predecessors.size());
+
+            auto add_user = [&](int value)
+            {
+                const auto& ir_value = m_program.values[value];
+                auto& users = m_user_blocks[value];
+                if ((ir_value.kind != IrValueKind::result || ir_value.block != b)
+                    && (users.empty() || users.back() != b))
+                {
+                    users.push_back(b);
+                }
+            };
+
+            for (const auto& phi : block.phis)
+            {
+                for (auto incoming : phi.incoming)
+                {
+                    add_user(incoming);
+                }
+            }
+
+            for (const auto& instruction : block.instructions)
+            {
+                for (auto value : instruction.pops)
+                {
+                    add_user(value);
+                }
+
+                for (auto value : instruction.reads)
+                {
+                    add_user(value);
+                }
+            }
+        }
+
+        add_edge(no_block, 0);
+
+        while (!m_work_list.empty())
+        {
+            auto block = m_work_list.top();
+            m_work_list.pop();
+            m_queued[block] = false;
+
+            visit_block(block);
+        }
+
+        std::size_t changes = 0;
+        for (std::size_t b = 0; b < blocks.size(); ++b)
+        {
+            // Blocks never reached are left to remove-unreachable.
+            if (m_reachable[b])
+            {
+                changes += fold_block(b);
+                changes += resolve_jump(b);
+            }
+        }
+
+        return changes;
+    }
+
+    void ConstantPropagation::queue(std::size_t block)
+    {
+        if (!m_queued[block])
+        {
+            m_queued[block] = true;
+            m_work_list.push(block);
+        }
+    }
+
+    void ConstantPropagation::add_edge(std::size_t from, std::size_t to)
+    {
+        if (to >= m_program.blocks.size())
+        {
+            return;
+        }
+
+        const auto& predecessors = m_program.blocks[to].predecessors;
+        bool added = false;
+        for (std::size_t k = 0; k < predecessors.size(); ++k)
+        {
+            if (predecessors[k] == from && !m_edges[to][k])
+            {
+                m_edges[to][k] = true;
+                added = true;
+            }
+        }
+
+        if (added)
+        {
+            m_reachable[to] = true;
+            queue(to);
+        }
+    }
+
+    void ConstantPropagation::set_value(int value, ConstantValue constant)
+    {
+        if (m_values[value] == constant)
+        {
+            return;
+        }
+
+        m_values[value] = constant;
+        for (auto user : m_user_blocks[value])
+        {
+            if (m_reachable[user])
+            {
+                queue(user);
+            }
+        }
+    }
+
+    void ConstantPropagation::visit_block(std::size_t b)
+    {
+        const auto& block = m_program.blocks[b];
+
+        for (const auto& phi : block.phis)
+        {
+            ConstantValue merged;
+            for (std::size_t k = 0; k < phi.incoming.size() && merged.kind != ConstantValue::Kind::varying; ++k)
+            {
+                if (!m_edges[b][k])
+                {
+                    continue;
+                }
+
+                const auto& incoming = m_values[phi.incoming[k]];
+                if (incoming.kind == ConstantValue::Kind::undefined)
+                {
+                    continue;
+                }
+
+                merged = merged.kind == ConstantValue::Kind::undefined || merged == incoming ? incoming
+                    : ConstantValue::varying();
+            }
+
+            set_value(phi.value, merged);
+        }
+
+        const IrInstruction* last = nullptr;
+        for (const auto& instruction : block.instructions)
+        {
+            if (instruction.removed)
+            {
+                continue;
+            }
+
+            if (instruction.results.size() == 1)
+            {
+                set_value(instruction.results[0], evaluate(instruction));
+            }
+            else
+            {
+                for (auto result : instruction.results)
+                {
+                    set_value(result, ConstantValue::varying());
+                }
+            }
+
+            last = &instruction;
+        }
+
+        if (last && is_jump(last->code.op_code))
+        {
+            visit_jump(b, *last);
+        }
+        else
+        {
+            add_edge(b, block.jump_target);
+            add_edge(b, block.next);
+        }
+    }
+
+    ConstantValue ConstantPropagation::evaluate(const IrInstruction& instruction) const
+    {
+        const auto& code = instruction.code;
+
+        auto unary = [&](auto operation)
+        {
+            const auto& operand = m_values[instruction.pops[0]];
+            return operand.is_constant() ? ConstantValue::of(operation(operand.value)) : operand;
+        };
+
+        auto binary = [&](auto operation)
+        {
+            const auto& lhs = m_values[instruction.pops[0]];
+            const auto& rhs = m_values[instruction.pops[1]];
+            if (lhs.kind == ConstantValue::Kind::varying || rhs.kind == ConstantValue::Kind::varying)
+            {
+                return ConstantValue::varying();
+            }
+
+            if (!lhs.is_constant() || !rhs.is_constant())
+            {
+                return ConstantValue();
+            }
+
+            return operation(lhs.value, rhs.value);
+        };
+
+        // The built-ins fail, or the machine traps, on these, so the instruction has to run.
+        auto divides = [](int lhs, int rhs)
+        {
+            return rhs != 0 && !(lhs == std::numeric_limits<int>::min() && rhs == -1);
+        };
+
+        switch (code.op_code)
+        {
+        case OpCode::push0:
+            return ConstantValue::of(0);
+        case OpCode::push_const:
+            return ConstantValue::of(code.a);
+        case OpCode::bump:
+        case OpCode::bump_unchecked:
+            return unary([](int value) { return wrap_add(value, 1); });
+        case OpCode::add_const:
+        case OpCode::add_const_unchecked:
+            return unary([&](int value) { return wrap_add(value, code.a); });
+        case OpCode::double_:
+            return unary([](int value) { return wrap_multiply(value, 2); });
+        case OpCode::negate:
+            return unary([](int value) { return wrap_subtract(0, value); });
+        case OpCode::clone:
+            return m_values[instruction.reads[0]];
+        case OpCode::add:
+        case OpCode::add_unchecked:
+            return binary([](int lhs, int rhs) { return ConstantValue::of(wrap_add(lhs, rhs)); });
+        case OpCode::subtract:
+        case OpCode::subtract_unchecked:
+            return binary([](int lhs, int rhs) { return ConstantValue::of(wrap_subtract(lhs, rhs)); });
+        case OpCode::multiply:
+        case OpCode::multiply_unchecked:
+            return binary([](int lhs, int rhs) { return ConstantValue::of(wrap_multiply(lhs, rhs)); });
+        case OpCode::divide:
+            return binary([&](int lhs, int rhs)
+            {
+                return divides(lhs, rhs) ? ConstantValue::of(lhs / rhs) : ConstantValue::varying();
+            });
+        case OpCode::mod:
+            return binary([&](int lhs, int rhs)
+            {
+                return divides(lhs, rhs) ? ConstantValue::of(lhs % rhs) : ConstantValue::varying();
+            });
+        default:
+            return ConstantValue::varying();
+        }
+    }
+
+    void ConstantPropagation::visit_jump(std::size_t b, const IrInstruction& jump)
+    {
+        const auto& block = m_program.blocks[b];
+
+        auto take = [&](bool taken)
+        {
+            add_edge(b, taken ? block.jump_target : block.next);
+        };
+
+        auto branch = [&](const ConstantValue& condition, auto taken)
+        {
+            if (condition.is_constant())
+            {
+                take(taken(condition.value));
+            }
+            else if (condition.kind == ConstantValue::Kind::varying)
+            {
+                take(true);
+                take(false);
+            }
+        };
+
+        auto is_zero = [](int value) { return value == 0; };
+        auto is_negative = [](int value) { return value < 0; };
+
+        switch (jump.code.op_code)
+        {
+        case OpCode::jz:
+        case OpCode::jz_unchecked:
+            branch(m_values[jump.reads[0]], is_zero);
+            break;
+        case OpCode::jneg:
+        case OpCode::jneg_unchecked:
+            branch(m_values[jump.reads[0]], is_negative);
+            break;
+        case OpCode::jump:
+        {
+            // Jump types other than 0, 1 and 2 fail, so they lead nowhere.
+            const auto& type = m_values[jump.pops[0]];
+            if (type.kind == ConstantValue::Kind::varying)
+            {
+                take(true);
+                take(false);
+            }
+            else if (type.is_constant() && type.value == 0)
+            {
+                take(true);
+            }
+            else if (type.is_constant() && (type.value == 1 || type.value == 2))
+            {
+                branch(m_values[jump.reads[0]], type.value == 1 ? +is_zero : +is_negative);
+            }
+            break;
+        }
+        default:
+            add_edge(b, block.jump_target);
+            add_edge(b, block.next);
+            break;
+        }
+    }
+
+    std::size_t ConstantPropagation::fold_block(std::size_t b)
+    {
+        auto& block = m_program.blocks[b];
+        std::size_t folded = 0;
+
+        for (std::size_t i = 0; i < block.instructions.size(); ++i)
+        {
+            auto& instruction = block.instructions[i];
+            auto op_code = instruction.code.op_code;
+            if (instruction.removed || instruction.results.size() != 1 || op_code == OpCode::push0
+                || op_code == OpCode::push_const)
+            {
+                continue;
+            }
+
+            const auto& constant = m_values[instruction.results[0]];
+            if (!constant.is_constant())
+            {
+                continue;
+            }
+
+            // The pushes of the operands go with the instruction, so the stack below is the same. Values read, by a
+            // clone, stay on the stack, and are there since they are constant on a path that reaches here.
+            bool removable = true;
+            for (auto pop : instruction.pops)
+            {
+                removable = removable && is_removable(m_program, pop, b, i);
+            }
+
+            if (!removable)
+            {
+                continue;
+            }
+
+            for (auto pop : instruction.pops)
+            {
+                remove_value(m_program, pop);
+            }
+
+            for (auto read : instruction.reads)
+            {
+                --m_program.values[read].uses;
+            }
+
+            instruction.pops.clear();
+            instruction.reads.clear();
+            instruction.code.op_code = OpCode::push_const;
+            instruction.code.a = constant.value;
+            instruction.effect = IrEffect::pure;
+            ++folded;
+        }
+
+        return folded;
+    }
+
+    std::size_t ConstantPropagation::resolve_jump(std::size_t b)
+    {
+        auto& block = m_program.blocks[b];
+        if (block.instructions.empty())
+        {
+            return 0;
+        }
+
+        auto& jump = block.instructions.back();
+        auto op_code = jump.code.op_code;
+        if (jump.removed || (op_code != OpCode::jz && op_code != OpCode::jz_unchecked && op_code != OpCode::jneg
+            && op_code != OpCode::jneg_unchecked))
+        {
+            return 0;
+        }
+
+        // A constant condition was pushed on every path here, so the jump cannot fail for want of it.
+        const auto& condition = m_values[jump.reads[0]];
+        if (!condition.is_constant())
+        {
+            return 0;
+        }
+
+        auto taken = op_code == OpCode::jz || op_code == OpCode::jz_unchecked ? condition.value == 0
+            : condition.value < 0;
+
+        if (taken)
+        {
+            --m_program.values[jump.reads[0]].uses;
+            jump.reads.clear();
+            jump.code.op_code = OpCode::jmp;
+            jump.effect = IrEffect::side_effect;
+
+            if (block.next < m_program.blocks.size())
+            {
+                remove_edge(m_program, b, block.next);
+            }
+
+            block.next = no_block;
+        }
+        else
+        {
+            remove_instruction(m_program, jump);
+
+            if (block.jump_target < m_program.blocks.size())
+            {
+                remove_edge(m_program, b, block.jump_target);
+            }
+
+            block.jump_target = no_block;
+        }
+
+        return 1;
+    }
+}
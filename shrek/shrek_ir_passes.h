@@ -0,0 +1,20 @@
+#ifndef _SHREK_IR_PASSES_H_INCLUDE_GUARD
+#define _SHREK_IR_PASSES_H_INCLUDE_GUARD
+
+#include "shrek_ir.h"
+
+namespace shrek
+{
+    // Remove pops of values nothing else uses, together with the pure instructions that computed them, such as a
+    // constant pushed and popped again or a clone that is only popped. Returns the number of instructions removed.
+    std::size_t remove_dead_values(IrProgram& program);
+
+    // Sparse conditional constant propagation. Finds the values that are the same constant on every path the program
+    // can take, following only the edges of conditional jumps whose condition is not known to be constant. Arithmetic
+    // on constants is replaced by a push of the result where the values it pops can be removed with it, and jumps on a
+    // constant become unconditional or are removed. Division and mod by zero, and the division of the smallest value
+    // by -1, are left to fail at run time. Returns the number of instructions folded and jumps resolved.
+    std::size_t propagate_constants(IrProgram& program);
+}
+
+#endif // _SHREK_IR_PASSES_H_INCLUDE_GUARD
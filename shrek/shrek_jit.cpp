@@ -0,0 +1,916 @@
+#include "shrek_jit.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define SHREK_JIT
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <limits>
+
+#include "shrek_platform_specific.h"
+
+namespace shrek
+{
+    bool jit_supported()
+    {
+#ifdef SHREK_JIT
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    JitProgram::~JitProgram()
+    {
+        if (m_memory)
+        {
+            free_executable_memory(m_memory, m_size);
+        }
+    }
+
+    bool JitProgram::run(JitContext& context, std::size_t start) const
+    {
+        using Entry = int (*)(JitContext* context, std::size_t start);
+
+        auto entry = reinterpret_cast<Entry>(m_memory);
+        return entry(&context, start) == 0;
+    }
+
+#ifdef SHREK_JIT
+    enum class X86Register
+    {
+        rax = 0,
+        rcx = 1,
+        rdx = 2,
+        rbx = 3,
+        rsp = 4,
+        rbp = 5,
+        rsi = 6,
+        rdi = 7,
+        r12 = 12,
+        r13 = 13,
+        r14 = 14
+    };
+
+    // Condition codes of jcc, as encoded in its op code.
+    enum class X86Condition
+    {
+        below = 0x2,
+        above_or_equal = 0x3,
+        equal = 0x4,
+        not_equal = 0x5,
+        below_or_equal = 0x6,
+        less = 0xc
+    };
+
+    // Registers compiled code keeps its state in. All are callee saved in the System V ABI, so they survive calls into
+    // the runtime, which reloads the stack pointers from the context.
+    constexpr auto top_register = X86Register::rbx;
+    constexpr auto context_register = X86Register::r12;
+    constexpr auto end_register = X86Register::r13;
+    constexpr auto begin_register = X86Register::r14;
+
+    constexpr int value_size = (int)sizeof(int);
+
+    // Position in the machine code, bound once the code it names has been emitted. Branches to a label are patched
+    // when the code is finished.
+    using JitLabel = std::size_t;
+
+    // Emits the few x86-64 instructions compiled code needs. Memory operands are a base register and a displacement.
+    class Assembler
+    {
+    public:
+        JitLabel new_label();
+        void bind(JitLabel label);
+        std::size_t position(JitLabel label) const { return m_labels[label]; }
+        std::size_t size() const { return m_bytes.size(); }
+
+        // Patch every branch to its label and return the code.
+        std::vector<std::uint8_t> finish();
+
+        void push(X86Register reg);
+        void pop(X86Register reg);
+        void ret() { byte(0xc3); }
+        void align(std::size_t alignment);
+        void zeros(std::size_t count) { m_bytes.insert(m_bytes.end(), count, 0); }
+
+        // 64-bit moves and arithmetic on pointers.
+        void load64(X86Register reg, X86Register base, int offset);
+        void store64(X86Register base, int offset, X86Register reg);
+        void lea64(X86Register reg, X86Register base, int offset);
+        void move64(X86Register dst, X86Register src);
+        void compare64(X86Register lhs, X86Register rhs);
+        void add64(X86Register reg, int value);
+        void subtract64(X86Register reg, int value);
+        void compare64(X86Register reg, int value);
+        void move_index(X86Register reg, std::size_t value);
+
+        // 32-bit operations on stack values.
+        void load32(X86Register reg, X86Register base, int offset);
+        void store32(X86Register base, int offset, X86Register reg);
+        void store32(X86Register base, int offset, int value);
+        void add32(X86Register base, int offset, int value);
+        void add32(X86Register base, int offset, X86Register reg);
+        void subtract32(X86Register base, int offset, X86Register reg);
+        void add32(X86Register reg, X86Register base, int offset);
+        void subtract32(X86Register reg, X86Register base, int offset);
+        void multiply32(X86Register reg, X86Register base, int offset);
+        void multiply32(X86Register reg, X86Register base, int offset, int value);
+        void negate32(X86Register base, int offset);
+        void double32(X86Register base, int offset);
+        void compare32(X86Register base, int offset, int value);
+        void move32(X86Register reg, int value);
+        void add32(X86Register reg, int value);
+
+        void jump(JitLabel label);
+        void jump(X86Condition condition, JitLabel label);
+        void call(X86Register base, int offset);
+        void clear32(X86Register reg);
+
+        // jmp [table + index * 8]
+        void jump_indexed(X86Register table, X86Register index);
+
+        // lea reg, [rip + label]
+        void load_address(X86Register reg, JitLabel label);
+
+    private:
+        static constexpr std::size_t unbound = std::numeric_limits<std::size_t>::max();
+
+        struct Fixup
+        {
+            // Position of a 32-bit displacement from the end of the instruction it ends.
+            std::size_t position;
+            JitLabel label;
+        };
+
+        std::vector<std::uint8_t> m_bytes;
+        std::vector<std::size_t> m_labels;
+        std::vector<Fixup> m_fixups;
+
+        void byte(int value) { m_bytes.push_back((std::uint8_t)value); }
+        void dword(std::uint32_t value);
+        void rex(bool wide, int reg, int base);
+        void memory_operand(int reg, X86Register base, int offset);
+        void memory_op(bool wide, std::initializer_list<int> op_code, int reg, X86Register base, int offset);
+        void register_op(bool wide, int op_code, int reg, int rm);
+        void immediate_op(int extension, X86Register reg, int value);
+        void label_displacement(JitLabel label);
+    };
+
+    JitLabel Assembler::new_label()
+    {
+        m_labels.push_back(unbound);
+        return m_labels.size() - 1;
+    }
+
+    void Assembler::bind(JitLabel label)
+    {
+        m_labels[label] = m_bytes.size();
+    }
+
+    std::vector<std::uint8_t> Assembler::finish()
+    {
+        for (const auto& fixup : m_fixups)
+        {
+            auto end = (std::int64_t)(fixup.position + 4);
+            auto displacement = (std::int32_t)((std::int64_t)m_labels[fixup.label] - end);
+            std::memcpy(&m_bytes[fixup.position], &displacement, sizeof(displacement));
+        }
+
+        m_fixups.clear();
+        return std::move(m_bytes);
+    }
+
+    void Assembler::push(X86Register reg)
+    {
+        rex(false, 0, (int)reg);
+        byte(0x50 + ((int)reg & 7));
+    }
+
+    void Assembler::pop(X86Register reg)
+    {
+        rex(false, 0, (int)reg);
+        byte(0x58 + ((int)reg & 7));
+    }
+
+    void Assembler::align(std::size_t alignment)
+    {
+        while (m_bytes.size() % alignment != 0)
+        {
+            byte(0xcc);
+        }
+    }
+
+    void Assembler::load64(X86Register reg, X86Register base, int offset)
+    {
+        memory_op(true, { 0x8b }, (int)reg, base, offset);
+    }
+
+    void Assembler::store64(X86Register base, int offset, X86Register reg)
+    {
+        memory_op(true, { 0x89 }, (int)reg, base, offset);
+    }
+
+    void Assembler::lea64(X86Register reg, X86Register base, int offset)
+    {
+        memory_op(true, { 0x8d }, (int)reg, base, offset);
+    }
+
+    void Assembler::move64(X86Register dst, X86Register src)
+    {
+        register_op(true, 0x89, (int)src, (int)dst);
+    }
+
+    void Assembler::compare64(X86Register lhs, X86Register rhs)
+    {
+        register_op(true, 0x39, (int)rhs, (int)lhs);
+    }
+
+    void Assembler::add64(X86Register reg, int value)
+    {
+        immediate_op(0, reg, value);
+    }
+
+    void Assembler::subtract64(X86Register reg, int value)
+    {
+        immediate_op(5, reg, value);
+    }
+
+    void Assembler::compare64(X86Register reg, int value)
+    {
+        immediate_op(7, reg, value);
+    }
+
+    void Assembler::load32(X86Register reg, X86Register base, int offset)
+    {
+        memory_op(false, { 0x8b }, (int)reg, base, offset);
+    }
+
+    void Assembler::store32(X86Register base, int offset, X86Register reg)
+    {
+        memory_op(false, { 0x89 }, (int)reg, base, offset);
+    }
+
+    void Assembler::add32(X86Register base, int offset, X86Register reg)
+    {
+        memory_op(false, { 0x01 }, (int)reg, base, offset);
+    }
+
+    void Assembler::subtract32(X86Register base, int offset, X86Register reg)
+    {
+        memory_op(false, { 0x29 }, (int)reg, base, offset);
+    }
+
+    void Assembler::add32(X86Register reg, X86Register base, int offset)
+    {
+        memory_op(false, { 0x03 }, (int)reg, base, offset);
+    }
+
+    void Assembler::subtract32(X86Register reg, X86Register base, int offset)
+    {
+        memory_op(false, { 0x2b }, (int)reg, base, offset);
+    }
+
+    void Assembler::multiply32(X86Register reg, X86Register base, int offset)
+    {
+        memory_op(false, { 0x0f, 0xaf }, (int)reg, base, offset);
+    }
+
+    void Assembler::negate32(X86Register base, int offset)
+    {
+        memory_op(false, { 0xf7 }, 3, base, offset);
+    }
+
+    void Assembler::double32(X86Register base, int offset)
+    {
+        memory_op(false, { 0xd1 }, 4, base, offset);
+    }
+
+    void Assembler::call(X86Register base, int offset)
+    {
+        memory_op(false, { 0xff }, 2, base, offset);
+    }
+
+    void Assembler::clear32(X86Register reg)
+    {
+        register_op(false, 0x31, (int)reg, (int)reg);
+    }
+
+    void Assembler::move_index(X86Register reg, std::size_t value)
+    {
+        // mov r32, imm32 clears the upper half, which covers every index compile_jit accepts.
+        rex(false, 0, (int)reg);
+        byte(0xb8 + ((int)reg & 7));
+        dword((std::uint32_t)value);
+    }
+
+    void Assembler::store32(X86Register base, int offset, int value)
+    {
+        memory_op(false, { 0xc7 }, 0, base, offset);
+        dword((std::uint32_t)value);
+    }
+
+    void Assembler::add32(X86Register base, int offset, int value)
+    {
+        if (value >= -128 && value <= 127)
+        {
+            memory_op(false, { 0x83 }, 0, base, offset);
+            byte(value);
+        }
+        else
+        {
+            memory_op(false, { 0x81 }, 0, base, offset);
+            dword((std::uint32_t)value);
+        }
+    }
+
+    void Assembler::multiply32(X86Register reg, X86Register base, int offset, int value)
+    {
+        memory_op(false, { 0x69 }, (int)reg, base, offset);
+        dword((std::uint32_t)value);
+    }
+
+    void Assembler::compare32(X86Register base, int offset, int value)
+    {
+        memory_op(false, { 0x83 }, 7, base, offset);
+        byte(value);
+    }
+
+    void Assembler::move32(X86Register reg, int value)
+    {
+        rex(false, 0, (int)reg);
+        byte(0xb8 + ((int)reg & 7));
+        dword((std::uint32_t)value);
+    }
+
+    void Assembler::add32(X86Register reg, int value)
+    {
+        rex(false, 0, (int)reg);
+        byte(0x81);
+        byte(0xc0 | ((int)reg & 7));
+        dword((std::uint32_t)value);
+    }
+
+    void Assembler::jump(JitLabel label)
+    {
+        byte(0xe9);
+        label_displacement(label);
+    }
+
+    void Assembler::jump(X86Condition condition, JitLabel label)
+    {
+        byte(0x0f);
+        byte(0x80 + (int)condition);
+        label_displacement(label);
+    }
+
+    void Assembler::jump_indexed(X86Register table, X86Register index)
+    {
+        // ModRM with a SIB byte and no displacement, so the table cannot be rbp or r13.
+        rex(false, 0, (int)table);
+        byte(0xff);
+        byte(0x24);
+        byte(0xc0 | (((int)index & 7) << 3) | ((int)table & 7));
+    }
+
+    void Assembler::load_address(X86Register reg, JitLabel label)
+    {
+        rex(true, (int)reg, 0);
+        byte(0x8d);
+        byte((((int)reg & 7) << 3) | 0x05);
+        label_displacement(label);
+    }
+
+    void Assembler::dword(std::uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            byte((int)(value >> (i * 8)) & 0xff);
+        }
+    }
+
+    void Assembler::rex(bool wide, int reg, int base)
+    {
+        auto prefix = 0x40 | (wide ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) | ((base & 8) ? 0x01 : 0);
+        if (prefix != 0x40)
+        {
+            byte(prefix);
+        }
+    }
+
+    void Assembler::memory_operand(int reg, X86Register base, int offset)
+    {
+        // Always with a displacement, so rbp and r13 need no special case. rsp and r12 need a SIB byte.
+        auto short_displacement = offset >= -128 && offset <= 127;
+        byte((short_displacement ? 0x40 : 0x80) | ((reg & 7) << 3) | ((int)base & 7));
+        if (((int)base & 7) == 4)
+        {
+            byte(0x24);
+        }
+
+        if (short_displacement)
+        {
+            byte(offset);
+        }
+        else
+        {
+            dword((std::uint32_t)offset);
+        }
+    }
+
+    void Assembler::memory_op(bool wide, std::initializer_list<int> op_code, int reg, X86Register base, int offset)
+    {
+        rex(wide, reg, (int)base);
+        for (auto op : op_code)
+        {
+            byte(op);
+        }
+
+        memory_operand(reg, base, offset);
+    }
+
+    void Assembler::register_op(bool wide, int op_code, int reg, int rm)
+    {
+        rex(wide, reg, rm);
+        byte(op_code);
+        byte(0xc0 | ((reg & 7) << 3) | (rm & 7));
+    }
+
+    void Assembler::immediate_op(int extension, X86Register reg, int value)
+    {
+        rex(true, 0, (int)reg);
+        if (value >= -128 && value <= 127)
+        {
+            byte(0x83);
+            byte(0xc0 | (extension << 3) | ((int)reg & 7));
+            byte(value);
+        }
+        else
+        {
+            byte(0x81);
+            byte(0xc0 | (extension << 3) | ((int)reg & 7));
+            dword((std::uint32_t)value);
+        }
+    }
+
+    void Assembler::label_displacement(JitLabel label)
+    {
+        m_fixups.push_back({ m_bytes.size(), label });
+        dword(0);
+    }
+
+    // Compiles one instruction at a time into the same sequence of machine instructions wherever it appears. The
+    // program is entered through a dispatch on the index to start at, which is also where calls into the runtime go
+    // when the instruction they ran did not continue with the next one.
+    class JitCompiler
+    {
+    public:
+        JitCompiler(const std::vector<ByteCode>& code);
+
+        std::vector<std::uint8_t> compile(JitResult& result);
+
+        // Offset of the table of instruction addresses, filled in once the code is in place.
+        std::size_t table_offset() const { return m_assembler.position(m_table); }
+
+        // Offset of the code of each instruction, in the order of the table.
+        std::vector<std::size_t> instruction_offsets() const;
+
+    private:
+        const std::vector<ByteCode>& m_code;
+        Assembler m_assembler;
+        std::vector<JitLabel> m_instructions;
+        JitLabel m_dispatch;
+        JitLabel m_exit;
+        JitLabel m_error;
+        JitLabel m_table;
+
+        // Instructions whose checks failed, run by the interpreter after the rest of the code so the checks fall
+        // through when they pass.
+        struct SlowPath
+        {
+            JitLabel label;
+            std::size_t index;
+        };
+
+        std::vector<SlowPath> m_slow_paths;
+
+        // Compile the instruction at index, returning false if it runs in the interpreter.
+        bool compile_instruction(std::size_t index);
+
+        void emit_prologue();
+        void emit_epilogue();
+        void emit_dispatch();
+        void emit_load_state();
+        void emit_run_instruction(std::size_t index);
+
+        // Branch to the interpreter for the instruction at index unless the stack holds count values, or has room for
+        // count more.
+        void check_values(std::size_t index, int count);
+        void check_room(std::size_t index);
+        JitLabel slow_path(std::size_t index);
+
+        JitLabel target(int index) const;
+        static int top_offset(int n) { return -(n + 1) * value_size; }
+        static int register_offset(int reg) { return reg * value_size; }
+    };
+
+    JitCompiler::JitCompiler(const std::vector<ByteCode>& code)
+        : m_code(code)
+    {
+        for (std::size_t i = 0; i < code.size(); ++i)
+        {
+            m_instructions.push_back(m_assembler.new_label());
+        }
+
+        m_dispatch = m_assembler.new_label();
+        m_exit = m_assembler.new_label();
+        m_error = m_assembler.new_label();
+        m_table = m_assembler.new_label();
+    }
+
+    std::vector<std::uint8_t> JitCompiler::compile(JitResult& result)
+    {
+        emit_prologue();
+
+        for (std::size_t i = 0; i < m_code.size(); ++i)
+        {
+            m_assembler.bind(m_instructions[i]);
+            if (compile_instruction(i))
+            {
+                ++result.compiled;
+            }
+            else
+            {
+                ++result.interpreted;
+            }
+        }
+
+        // Linked code ends with halt, but leave the same way if it did not.
+        m_assembler.jump(m_exit);
+
+        for (const auto& slow : m_slow_paths)
+        {
+            m_assembler.bind(slow.label);
+            emit_run_instruction(slow.index);
+            if (slow.index + 1 < m_code.size())
+            {
+                m_assembler.jump(m_instructions[slow.index + 1]);
+            }
+            else
+            {
+                m_assembler.jump(m_exit);
+            }
+        }
+
+        emit_dispatch();
+        emit_epilogue();
+
+        m_assembler.align(sizeof(void*));
+        m_assembler.bind(m_table);
+        m_assembler.zeros(m_code.size() * sizeof(void*));
+
+        result.code_size = m_assembler.size();
+        return m_assembler.finish();
+    }
+
+    std::vector<std::size_t> JitCompiler::instruction_offsets() const
+    {
+        std::vector<std::size_t> offsets;
+        offsets.reserve(m_instructions.size());
+        for (auto label : m_instructions)
+        {
+            offsets.push_back(m_assembler.position(label));
+        }
+
+        return offsets;
+    }
+
+    bool JitCompiler::compile_instruction(std::size_t index)
+    {
+        auto& as = m_assembler;
+        const auto& code = m_code[index];
+        auto top = top_register;
+        auto begin = begin_register;
+
+        switch (code.op_code)
+        {
+        case OpCode::no_op:
+        case OpCode::label:
+            return true;
+        case OpCode::push0:
+        case OpCode::push_const:
+            check_room(index);
+            as.store32(top, 0, code.op_code == OpCode::push0 ? 0 : code.a);
+            as.add64(top, value_size);
+            return true;
+        case OpCode::pop:
+            check_values(index, 1);
+            as.subtract64(top, value_size);
+            return true;
+        case OpCode::pop_unchecked:
+            as.subtract64(top, value_size);
+            return true;
+        case OpCode::bump:
+            check_values(index, 1);
+            as.add32(top, top_offset(0), 1);
+            return true;
+        case OpCode::bump_unchecked:
+            as.add32(top, top_offset(0), 1);
+            return true;
+        case OpCode::add_const:
+            check_values(index, 1);
+            as.add32(top, top_offset(0), code.a);
+            return true;
+        case OpCode::add_const_unchecked:
+            as.add32(top, top_offset(0), code.a);
+            return true;
+        case OpCode::add:
+        case OpCode::add_unchecked:
+            if (code.op_code == OpCode::add)
+            {
+                check_values(index, 2);
+            }
+
+            as.load32(X86Register::rax, top, top_offset(0));
+            as.add32(top, top_offset(1), X86Register::rax);
+            as.subtract64(top, value_size);
+            return true;
+        case OpCode::subtract:
+        case OpCode::subtract_unchecked:
+            if (code.op_code == OpCode::subtract)
+            {
+                check_values(index, 2);
+            }
+
+            as.load32(X86Register::rax, top, top_offset(0));
+            as.subtract32(top, top_offset(1), X86Register::rax);
+            as.subtract64(top, value_size);
+            return true;
+        case OpCode::multiply:
+        case OpCode::multiply_unchecked:
+            if (code.op_code == OpCode::multiply)
+            {
+                check_values(index, 2);
+            }
+
+            as.load32(X86Register::rax, top, top_offset(1));
+            as.multiply32(X86Register::rax, top, top_offset(0));
+            as.store32(top, top_offset(1), X86Register::rax);
+            as.subtract64(top, value_size);
+            return true;
+        case OpCode::double_:
+            check_values(index, 1);
+            as.double32(top, top_offset(0));
+            return true;
+        case OpCode::negate:
+            check_values(index, 1);
+            as.negate32(top, top_offset(0));
+            return true;
+        case OpCode::clone:
+            check_values(index, 1);
+            check_room(index);
+            as.load32(X86Register::rax, top, top_offset(0));
+            as.store32(top, 0, X86Register::rax);
+            as.add64(top, value_size);
+            return true;
+        case OpCode::jmp:
+            as.jump(target(code.a));
+            return true;
+        case OpCode::jz:
+        case OpCode::jz_unchecked:
+        case OpCode::jneg:
+        case OpCode::jneg_unchecked:
+            if (code.op_code == OpCode::jz || code.op_code == OpCode::jneg)
+            {
+                check_values(index, 1);
+            }
+
+            as.compare32(top, top_offset(0), 0);
+            as.jump(code.op_code == OpCode::jz || code.op_code == OpCode::jz_unchecked ? X86Condition::equal
+                : X86Condition::less, target(code.a));
+            return true;
+        case OpCode::reg_set:
+            as.store32(begin, register_offset(code.b), code.a);
+            return true;
+        case OpCode::reg_move:
+            as.load32(X86Register::rax, begin, register_offset(code.c));
+            as.store32(begin, register_offset(code.b), X86Register::rax);
+            return true;
+        case OpCode::reg_add:
+        case OpCode::reg_sub:
+        case OpCode::reg_mul:
+            as.load32(X86Register::rax, begin, register_offset(code.c));
+            if (code.op_code == OpCode::reg_add)
+            {
+                as.add32(X86Register::rax, begin, register_offset(code.a));
+            }
+            else if (code.op_code == OpCode::reg_sub)
+            {
+                as.subtract32(X86Register::rax, begin, register_offset(code.a));
+            }
+            else
+            {
+                as.multiply32(X86Register::rax, begin, register_offset(code.a));
+            }
+
+            as.store32(begin, register_offset(code.b), X86Register::rax);
+            return true;
+        case OpCode::reg_add_imm:
+            as.load32(X86Register::rax, begin, register_offset(code.c));
+            as.add32(X86Register::rax, code.a);
+            as.store32(begin, register_offset(code.b), X86Register::rax);
+            return true;
+        case OpCode::reg_rsub_imm:
+            as.move32(X86Register::rax, code.a);
+            as.subtract32(X86Register::rax, begin, register_offset(code.c));
+            as.store32(begin, register_offset(code.b), X86Register::rax);
+            return true;
+        case OpCode::reg_mul_imm:
+            as.multiply32(X86Register::rax, begin, register_offset(code.c), code.a);
+            as.store32(begin, register_offset(code.b), X86Register::rax);
+            return true;
+        case OpCode::reg_jz:
+        case OpCode::reg_jneg:
+            as.compare32(begin, register_offset(code.b), 0);
+            as.jump(code.op_code == OpCode::reg_jz ? X86Condition::equal : X86Condition::less, target(code.a));
+            return true;
+        case OpCode::reg_sync:
+            as.lea64(top, begin, register_offset(code.a));
+            return true;
+        case OpCode::halt:
+            as.jump(m_exit);
+            return true;
+        default:
+            // Calls, the generic jump, input and output, division and superinstructions.
+            emit_run_instruction(index);
+            return false;
+        }
+    }
+
+    void JitCompiler::emit_prologue()
+    {
+        auto& as = m_assembler;
+
+        // Four pushes and the return address leave the stack 8 bytes off the 16 byte alignment calls need.
+        as.push(X86Register::rbx);
+        as.push(X86Register::r12);
+        as.push(X86Register::r13);
+        as.push(X86Register::r14);
+        as.subtract64(X86Register::rsp, 8);
+
+        // Entered with the context in rdi and the index to start at in rsi.
+        as.move64(context_register, X86Register::rdi);
+        emit_load_state();
+        as.move64(X86Register::rax, X86Register::rsi);
+        as.jump(m_dispatch);
+    }
+
+    void JitCompiler::emit_epilogue()
+    {
+        auto& as = m_assembler;
+
+        as.bind(m_error);
+        as.move32(X86Register::rax, 1);
+        JitLabel leave = as.new_label();
+        as.jump(leave);
+
+        as.bind(m_exit);
+        as.clear32(X86Register::rax);
+
+        as.bind(leave);
+        as.store64(context_register, (int)offsetof(JitContext, top), top_register);
+        as.add64(X86Register::rsp, 8);
+        as.pop(X86Register::r14);
+        as.pop(X86Register::r13);
+        as.pop(X86Register::r12);
+        as.pop(X86Register::rbx);
+        as.ret();
+    }
+
+    void JitCompiler::emit_dispatch()
+    {
+        auto& as = m_assembler;
+
+        // Index of the instruction to continue at in rax, which is past the end once the program has halted.
+        as.bind(m_dispatch);
+        as.compare64(X86Register::rax, -1);
+        as.jump(X86Condition::equal, m_error);
+        as.move_index(X86Register::rcx, m_code.size());
+        as.compare64(X86Register::rax, X86Register::rcx);
+        as.jump(X86Condition::above_or_equal, m_exit);
+        as.load_address(X86Register::rcx, m_table);
+        as.jump_indexed(X86Register::rcx, X86Register::rax);
+    }
+
+    void JitCompiler::emit_load_state()
+    {
+        auto& as = m_assembler;
+        as.load64(begin_register, context_register, (int)offsetof(JitContext, begin));
+        as.load64(top_register, context_register, (int)offsetof(JitContext, top));
+        as.load64(end_register, context_register, (int)offsetof(JitContext, end));
+    }
+
+    void JitCompiler::emit_run_instruction(std::size_t index)
+    {
+        auto& as = m_assembler;
+
+        as.store64(context_register, (int)offsetof(JitContext, top), top_register);
+        as.move64(X86Register::rdi, context_register);
+        as.move_index(X86Register::rsi, index);
+        as.call(context_register, (int)offsetof(JitContext, run_instruction));
+        emit_load_state();
+
+        // Carry on with the next instruction, unless it jumped, halted or threw.
+        as.move_index(X86Register::rcx, index + 1);
+        as.compare64(X86Register::rax, X86Register::rcx);
+        as.jump(X86Condition::not_equal, m_dispatch);
+    }
+
+    void JitCompiler::check_values(std::size_t index, int count)
+    {
+        auto& as = m_assembler;
+        as.lea64(X86Register::rax, begin_register, count * value_size);
+        as.compare64(top_register, X86Register::rax);
+        as.jump(X86Condition::below, slow_path(index));
+    }
+
+    void JitCompiler::check_room(std::size_t index)
+    {
+        auto& as = m_assembler;
+        as.compare64(top_register, end_register);
+        as.jump(X86Condition::above_or_equal, slow_path(index));
+    }
+
+    JitLabel JitCompiler::slow_path(std::size_t index)
+    {
+        // One per instruction, shared by its checks.
+        if (m_slow_paths.empty() || m_slow_paths.back().index != index)
+        {
+            m_slow_paths.push_back({ m_assembler.new_label(), index });
+        }
+
+        return m_slow_paths.back().label;
+    }
+
+    JitLabel JitCompiler::target(int index) const
+    {
+        if (index < 0 || (std::size_t)index >= m_code.size())
+        {
+            return m_exit;
+        }
+
+        return m_instructions[(std::size_t)index];
+    }
+
+    std::unique_ptr<JitProgram> compile_jit(const std::vector<ByteCode>& code, JitResult& result)
+    {
+        result = JitResult();
+
+        // Indexes are moved into registers as 32-bit values, and the table is addressed with them.
+        if (code.size() >= (std::size_t)std::numeric_limits<std::int32_t>::max())
+        {
+            return nullptr;
+        }
+
+        JitCompiler compiler(code);
+        auto bytes = compiler.compile(result);
+
+        auto memory = allocate_executable_memory(bytes.size());
+        if (memory == nullptr)
+        {
+            return nullptr;
+        }
+
+        auto program = std::make_unique<JitProgram>();
+        program->m_memory = memory;
+        program->m_size = bytes.size();
+
+        // The table holds absolute addresses, only known once the code has its place.
+        auto* base = static_cast<std::uint8_t*>(memory);
+        auto table = compiler.table_offset();
+        auto offsets = compiler.instruction_offsets();
+        for (std::size_t i = 0; i < offsets.size(); ++i)
+        {
+            auto address = (std::uint64_t)(std::uintptr_t)(base + offsets[i]);
+            std::memcpy(&bytes[table + i * sizeof(address)], &address, sizeof(address));
+        }
+
+        std::memcpy(memory, bytes.data(), bytes.size());
+        if (!protect_executable_memory(memory, bytes.size()))
+        {
+            return nullptr;
+        }
+
+        return program;
+    }
+#else
+    std::unique_ptr<JitProgram> compile_jit(const std::vector<ByteCode>& code, JitResult& result)
+    {
+        result = JitResult();
+        return nullptr;
+    }
+#endif
+}
@@ -0,0 +1,69 @@
+#ifndef _SHREK_JIT_H_INCLUDE_GUARD
+#define _SHREK_JIT_H_INCLUDE_GUARD
+
+#include <limits>
+#include <memory>
+
+#include "shrek_types.h"
+
+namespace shrek
+{
+    // Returned by JitContext::run_instruction when the instruction threw.
+    constexpr std::size_t jit_error = std::numeric_limits<std::size_t>::max();
+
+    // State shared by compiled code and the runtime. Compiled code keeps the stack pointers in registers, and only
+    // writes them here before calling run_instruction, which leaves them pointing at the stack as it left it.
+    struct JitContext
+    {
+        int* begin = nullptr;
+        int* top = nullptr;
+        int* end = nullptr;
+
+        // Run the instruction at index with the interpreter and return the index of the next instruction, or jit_error
+        // if it threw. Must not throw itself, as there is compiled code between it and whoever would catch it.
+        std::size_t (*run_instruction)(JitContext* context, std::size_t index) = nullptr;
+        void* runtime = nullptr;
+    };
+
+    struct JitResult
+    {
+        // Instructions compiled to machine code, and those left to run_instruction.
+        std::size_t compiled = 0;
+        std::size_t interpreted = 0;
+
+        // Bytes of machine code, including the table of instruction addresses.
+        std::size_t code_size = 0;
+    };
+
+    // Linked code compiled to machine code in executable memory, which is freed with it.
+    class JitProgram
+    {
+    public:
+        JitProgram() = default;
+        JitProgram(const JitProgram&) = delete;
+        JitProgram& operator=(const JitProgram&) = delete;
+        ~JitProgram();
+
+        // Run from the instruction at start until the program ends. Returns false if an instruction threw, in which
+        // case run_instruction has kept the exception.
+        bool run(JitContext& context, std::size_t start) const;
+
+    private:
+        friend std::unique_ptr<JitProgram> compile_jit(const std::vector<ByteCode>& code, JitResult& result);
+
+        void* m_memory = nullptr;
+        std::size_t m_size = 0;
+    };
+
+    // True if compile_jit can produce code on this platform, which is x86-64 Linux.
+    bool jit_supported();
+
+    // Compile linked code, as a template JIT: each instruction becomes a fixed sequence of machine instructions that
+    // works on the value stack in memory, and jumps become branches. Pushes, pops, arithmetic that cannot fail once the
+    // stack holds its operands, jumps and register instructions are compiled. Everything else, along with any check
+    // that fails, calls run_instruction, so calls, input and output, and every runtime error, behave exactly as they do
+    // in the interpreter. Returns nullptr if the platform is not supported or no executable memory could be had.
+    std::unique_ptr<JitProgram> compile_jit(const std::vector<ByteCode>& code, JitResult& result);
+}
+
+#endif // _SHREK_JIT_H_INCLUDE_GUARD
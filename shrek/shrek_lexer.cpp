@@ -0,0 +1,227 @@
+#include "shrek_lexer.h"
+
+#include <cassert>
+#include <string>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SHREK_LEXER_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace shrek
+{
+    namespace scalar
+    {
+        static std::size_t skip_whitespace(const char* code, std::size_t index, std::size_t size)
+        {
+            while (index < size && char_class(code[index]) == CharClass::whitespace)
+            {
+                ++index;
+            }
+
+            return index;
+        }
+
+        static std::size_t skip_letters(const char* code, std::size_t index, std::size_t size)
+        {
+            while (index < size && char_class(code[index]) == CharClass::command)
+            {
+                ++index;
+            }
+
+            return index;
+        }
+
+        static std::size_t find_line_end(const char* code, std::size_t index, std::size_t size)
+        {
+            while (index < size && code[index] != '\n')
+            {
+                ++index;
+            }
+
+            return index;
+        }
+    }
+
+#ifdef SHREK_LEXER_SSE2
+    // Classifies 16 bytes per step. Each classifier returns a bitmask with bit i set when byte i belongs to the class,
+    // so the end of a run is the lowest clear bit.
+    namespace simd
+    {
+        constexpr std::size_t block_size = 16;
+
+        static inline unsigned first_set_bit(unsigned mask)
+        {
+#if defined(_MSC_VER)
+            unsigned long result;
+            _BitScanForward(&result, mask);
+            return (unsigned)result;
+#else
+            return (unsigned)__builtin_ctz(mask);
+#endif
+        }
+
+        static inline unsigned whitespace_mask(__m128i block)
+        {
+            // "\t" through "\r" are contiguous, so (c - 9) <= 4 as an unsigned compare catches all of them.
+            auto space = _mm_cmpeq_epi8(block, _mm_set1_epi8(' '));
+            auto shifted = _mm_sub_epi8(block, _mm_set1_epi8('\t'));
+            auto control = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(4)), shifted);
+
+            return (unsigned)_mm_movemask_epi8(_mm_or_si128(space, control));
+        }
+
+        static inline unsigned letter_mask(__m128i block)
+        {
+            auto s = _mm_cmpeq_epi8(block, _mm_set1_epi8('S'));
+            auto h = _mm_cmpeq_epi8(block, _mm_set1_epi8('H'));
+            auto r = _mm_cmpeq_epi8(block, _mm_set1_epi8('R'));
+            auto e = _mm_cmpeq_epi8(block, _mm_set1_epi8('E'));
+            auto k = _mm_cmpeq_epi8(block, _mm_set1_epi8('K'));
+
+            auto result = _mm_or_si128(_mm_or_si128(s, h), _mm_or_si128(_mm_or_si128(r, e), k));
+            return (unsigned)_mm_movemask_epi8(result);
+        }
+
+        static inline unsigned newline_mask(__m128i block)
+        {
+            return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8('\n')));
+        }
+
+        static inline __m128i load_block(const char* code, std::size_t index)
+        {
+            return _mm_loadu_si128(reinterpret_cast<const __m128i*>(code + index));
+        }
+
+        static std::size_t skip_whitespace(const char* code, std::size_t index, std::size_t size)
+        {
+            while (index + block_size <= size)
+            {
+                auto outside = ~whitespace_mask(load_block(code, index)) & 0xffff;
+                if (outside)
+                {
+                    return index + first_set_bit(outside);
+                }
+
+                index += block_size;
+            }
+
+            return scalar::skip_whitespace(code, index, size);
+        }
+
+        static std::size_t skip_letters(const char* code, std::size_t index, std::size_t size)
+        {
+            while (index + block_size <= size)
+            {
+                auto outside = ~letter_mask(load_block(code, index)) & 0xffff;
+                if (outside)
+                {
+                    return index + first_set_bit(outside);
+                }
+
+                index += block_size;
+            }
+
+            return scalar::skip_letters(code, index, size);
+        }
+
+        static std::size_t find_line_end(const char* code, std::size_t index, std::size_t size)
+        {
+            while (index + block_size <= size)
+            {
+                auto newlines = newline_mask(load_block(code, index));
+                if (newlines)
+                {
+                    return index + first_set_bit(newlines);
+                }
+
+                index += block_size;
+            }
+
+            return scalar::find_line_end(code, index, size);
+        }
+    }
+#endif
+
+    static const ScanRoutines scalar_routines = { scalar::skip_whitespace, scalar::skip_letters, scalar::find_line_end };
+
+#ifdef SHREK_LEXER_SSE2
+    static const ScanRoutines simd_routines = { simd::skip_whitespace, simd::skip_letters, simd::find_line_end };
+#endif
+
+    bool simd_lexer_supported()
+    {
+#ifdef SHREK_LEXER_SSE2
+        // SSE2 is part of the x86-64 baseline and required by the 32 bit build flags, so there is nothing to detect.
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    const ScanRoutines& scan_routines(LexerBackend backend)
+    {
+#ifdef SHREK_LEXER_SSE2
+        if (backend == LexerBackend::simd)
+        {
+            return simd_routines;
+        }
+#endif
+
+        return scalar_routines;
+    }
+
+    std::size_t next_token(std::string_view code, std::size_t index, const ScanRoutines& scan, TokenView& result)
+    {
+        assert(index < code.size());
+
+        const auto size = code.size();
+        auto end = index + 1;
+
+        switch (char_class(code[index]))
+        {
+        case CharClass::command:
+            result.token_type = TokenType::command;
+            break;
+        case CharClass::label_delim:
+            // A label is "!" followed by one or more SHREK letters and a closing "!". Anything else starting with "!"
+            // is not a valid token.
+            end = scan.skip_letters(code.data(), end, size);
+
+            if (end == index + 1 || end == size || code[end] != '!')
+            {
+                throw SyntaxError("Invalid token", index, std::string(code.substr(index, 1)));
+            }
+
+            ++end;
+            result.token_type = TokenType::label;
+            break;
+        case CharClass::whitespace:
+            end = scan.skip_whitespace(code.data(), end, size);
+
+            result.token_type = TokenType::whitespace;
+            break;
+        case CharClass::comment:
+            // Comment runs to the end of the line, including the new line character.
+            end = scan.find_line_end(code.data(), end, size);
+            if (end < size)
+            {
+                ++end;
+            }
+
+            result.token_type = TokenType::comment;
+            break;
+        default:
+            throw SyntaxError("Invalid token", index, std::string(code.substr(index, 1)));
+        }
+
+        result.value = code.substr(index, end - index);
+        result.index = index;
+
+        return end;
+    }
+}
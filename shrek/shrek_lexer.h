@@ -0,0 +1,84 @@
+#ifndef _SHREK_LEXER_H_INCLUDE_GUARD
+#define _SHREK_LEXER_H_INCLUDE_GUARD
+
+#include <array>
+#include <cstddef>
+#include <string_view>
+
+#include "shrek_types.h"
+
+namespace shrek
+{
+    enum class LexerBackend
+    {
+        scalar,
+        simd,
+        cross_check // Run both backends and fail if they disagree.
+    };
+
+    enum class CharClass : unsigned char
+    {
+        invalid,
+        command,
+        label_delim,
+        whitespace,
+        comment
+    };
+
+    // Classification of every byte value, so the scanner needs a single table load per character. Whitespace is the
+    // same set of characters as the "\s" class the tokenizer used to be written with.
+    constexpr std::array<CharClass, 256> make_char_class_table()
+    {
+        std::array<CharClass, 256> table{};
+
+        for (auto c : { 'S', 'H', 'R', 'E', 'K' })
+        {
+            table[(unsigned char)c] = CharClass::command;
+        }
+
+        for (auto c : { ' ', '\t', '\n', '\v', '\f', '\r' })
+        {
+            table[(unsigned char)c] = CharClass::whitespace;
+        }
+
+        table[(unsigned char)'!'] = CharClass::label_delim;
+        table[(unsigned char)'#'] = CharClass::comment;
+
+        return table;
+    }
+
+    inline constexpr auto char_class_table = make_char_class_table();
+
+    inline CharClass char_class(char c)
+    {
+        return char_class_table[(unsigned char)c];
+    }
+
+    // Run scanning routines used by the tokenizer. Each routine starts at index and returns the index of the first
+    // character that does not belong to the run, or size if the run reaches the end of the code.
+    struct ScanRoutines
+    {
+        std::size_t (*skip_whitespace)(const char* code, std::size_t index, std::size_t size);
+        std::size_t (*skip_letters)(const char* code, std::size_t index, std::size_t size);
+        std::size_t (*find_line_end)(const char* code, std::size_t index, std::size_t size);
+    };
+
+    bool simd_lexer_supported();
+
+    // Get the routines for a backend. Falls back to the scalar routines if the SIMD backend is not supported.
+    const ScanRoutines& scan_routines(LexerBackend backend);
+
+    // Token as produced by the scanner. The value is a slice of the code, so scanning does not allocate.
+    struct TokenView
+    {
+        TokenType token_type = TokenType::whitespace;
+        std::string_view value;
+        std::size_t index = 0;
+    };
+
+    // Scan the token starting at index, which must be less than the size of the code, and return the index just past
+    // it. Throws SyntaxError for a character that cannot start a token or a label that is not closed.
+    std::size_t next_token(std::string_view code, std::size_t index, const ScanRoutines& scan, TokenView& result);
+}
+
+#endif // _SHREK_LEXER_H_INCLUDE_GUARD
@@ -0,0 +1,64 @@
+#include "shrek_linker.h"
+
+#include <limits>
+
+namespace shrek
+{
+    constexpr auto undefined_label = std::numeric_limits<std::size_t>::max();
+
+    void link_byte_code(std::vector<ByteCode>& code)
+    {
+        // Find where every label ends up once labels are removed from the code.
+        std::vector<std::size_t> label_locations;
+        std::size_t linked_size = 0;
+
+        for (const auto& byte : code)
+        {
+            if (byte.op_code == OpCode::label)
+            {
+                if ((std::size_t)byte.a >= label_locations.size())
+                {
+                    label_locations.resize((std::size_t)byte.a + 1, undefined_label);
+                }
+
+                label_locations[byte.a] = linked_size;
+            }
+            else
+            {
+                ++linked_size;
+            }
+        }
+
+        std::size_t write = 0;
+        for (std::size_t read = 0; read < code.size(); ++read)
+        {
+            auto byte = code[read];
+
+            if (byte.op_code == OpCode::label)
+            {
+                continue;
+            }
+
+            if (is_jump(byte.op_code))
+            {
+                auto target = undefined_label;
+                if ((std::size_t)byte.a < label_locations.size())
+                {
+                    target = label_locations[byte.a];
+                }
+
+                byte.a = (int)(target == undefined_label ? linked_size : target);
+            }
+
+            code[write++] = byte;
+        }
+
+        code.resize(write);
+
+        // Labels at the very end and undefined labels both target the halt, so every jump lands on an instruction.
+        ByteCode halt;
+        halt.source_code_index = code.empty() ? 0 : code.back().source_code_index;
+        halt.op_code = OpCode::halt;
+        code.push_back(halt);
+    }
+}
@@ -0,0 +1,14 @@
+#ifndef _SHREK_LINKER_H_INCLUDE_GUARD
+#define _SHREK_LINKER_H_INCLUDE_GUARD
+
+#include "shrek_types.h"
+
+namespace shrek
+{
+    // Resolve jumps to absolute byte code positions. Each jump's label number in a is replaced by the position of the
+    // instruction following the label, and label byte codes are removed. A halt is appended to the code, which is the
+    // target of jumps to labels that are never defined.
+    void link_byte_code(std::vector<ByteCode>& code);
+}
+
+#endif // _SHREK_LINKER_H_INCLUDE_GUARD
@@ -0,0 +1,180 @@
+#include "shrek_optimizer.h"
+
+#include <limits>
+
+#include "shrek_builtins.h"
+
+namespace shrek
+{
+    static std::size_t count_bumps(const std::vector<ByteCode>& code, std::size_t index);
+    static bool constant_value(const ByteCode& code, int& value);
+
+    std::size_t fold_constants(std::vector<ByteCode>& code)
+    {
+        std::size_t write = 0;
+        std::size_t read = 0;
+
+        while (read < code.size())
+        {
+            auto current = code[read];
+
+            if (current.op_code == OpCode::push0)
+            {
+                auto bumps = count_bumps(code, read + 1);
+                if (bumps > 0)
+                {
+                    // Keep the index of the push, so errors point to the start of the literal.
+                    current.op_code = OpCode::push_const;
+                    current.a = (int)bumps;
+                }
+
+                read += bumps + 1;
+            }
+            else if (current.op_code == OpCode::bump)
+            {
+                auto bumps = count_bumps(code, read);
+                if (bumps > 1)
+                {
+                    current.op_code = OpCode::add_const;
+                    current.a = (int)bumps;
+                }
+
+                read += bumps;
+            }
+            else
+            {
+                ++read;
+            }
+
+            code[write++] = current;
+        }
+
+        auto removed = code.size() - write;
+        code.resize(write);
+
+        return removed;
+    }
+
+    std::size_t specialize_jumps(std::vector<ByteCode>& code)
+    {
+        constexpr OpCode jump_op_codes[] = { OpCode::jmp, OpCode::jz, OpCode::jneg };
+        constexpr int jump_type_count = (int)(sizeof(jump_op_codes) / sizeof(jump_op_codes[0]));
+
+        std::size_t write = 0;
+        std::size_t read = 0;
+
+        while (read < code.size())
+        {
+            auto current = code[read++];
+
+            int jump_type;
+            if (read < code.size() && code[read].op_code == OpCode::jump && constant_value(current, jump_type)
+                && jump_type >= 0 && jump_type < jump_type_count)
+            {
+                current = code[read++];
+                current.op_code = jump_op_codes[jump_type];
+            }
+
+            code[write++] = current;
+        }
+
+        auto removed = code.size() - write;
+        code.resize(write);
+
+        return removed;
+    }
+
+    std::size_t use_intrinsics(std::vector<ByteCode>& code, const FunctionTable& func_table)
+    {
+        bool unmodified[intrinsic_count];
+        for (int i = 0; i < intrinsic_count; ++i)
+        {
+            auto function = func_table.find(i);
+            unmodified[i] = function && function->func == builtins::builtin_func(i);
+        }
+
+        std::size_t write = 0;
+        std::size_t read = 0;
+
+        while (read < code.size())
+        {
+            auto current = code[read++];
+
+            // Labels are instructions until the code is linked, so nothing can jump between the push and the func.
+            int func_number;
+            if (read < code.size() && code[read].op_code == OpCode::func && constant_value(current, func_number)
+                && func_number >= 0 && func_number < intrinsic_count && unmodified[func_number])
+            {
+                current = code[read++];
+                current.op_code = intrinsic_op_code(func_number);
+            }
+
+            code[write++] = current;
+        }
+
+        auto removed = code.size() - write;
+        code.resize(write);
+
+        return removed;
+    }
+
+    std::size_t bind_calls(std::vector<ByteCode>& code, const FunctionTable& func_table)
+    {
+        std::size_t bound = 0;
+        std::size_t write = 0;
+        std::size_t read = 0;
+
+        while (read < code.size())
+        {
+            auto current = code[read++];
+
+            int func_number;
+            if (read < code.size() && code[read].op_code == OpCode::func && constant_value(current, func_number))
+            {
+                auto function = func_table.find(func_number);
+                if (function)
+                {
+                    current = code[read++];
+                    current.op_code = function->fast_func ? OpCode::call_fast : OpCode::call_direct;
+                    current.a = func_number;
+                    current.function = function;
+                    ++bound;
+                }
+            }
+
+            code[write++] = current;
+        }
+
+        code.resize(write);
+
+        return bound;
+    }
+
+    static std::size_t count_bumps(const std::vector<ByteCode>& code, std::size_t index)
+    {
+        constexpr auto max_bumps = (std::size_t)std::numeric_limits<int>::max();
+
+        std::size_t count = 0;
+        while (index + count < code.size() && code[index + count].op_code == OpCode::bump && count < max_bumps)
+        {
+            ++count;
+        }
+
+        return count;
+    }
+
+    static bool constant_value(const ByteCode& code, int& value)
+    {
+        switch (code.op_code)
+        {
+        case OpCode::push0:
+            value = 0;
+            return true;
+        case OpCode::push_const:
+            value = code.a;
+            return true;
+        default:
+            return false;
+        }
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef _SHREK_OPTIMIZER_H_INCLUDE_GUARD
+#define _SHREK_OPTIMIZER_H_INCLUDE_GUARD
+
+#include "shrek_function_table.h"
+#include "shrek_types.h"
+
+namespace shrek
+{
+    // Collapse push0 followed by bumps into a single push_const, and runs of bumps into add_const. Labels end a run,
+    // so every jump target is still the start of an instruction. Returns the number of instructions removed.
+    std::size_t fold_constants(std::vector<ByteCode>& code);
+
+    // Replace a constant jump type followed by jump with jmp, jz or jneg, which do not push and pop the type. Jumps with
+    // an invalid constant type are left alone so they still fail at run time. Returns the number of jumps replaced.
+    std::size_t specialize_jumps(std::vector<ByteCode>& code);
+
+    // Replace a constant function number followed by func with the intrinsic op code, for each built-in function still
+    // registered under its own number. Run after fold_constants. Returns the number of calls replaced.
+    std::size_t use_intrinsics(std::vector<ByteCode>& code, const FunctionTable& func_table);
+
+    // Replace a constant function number followed by func with a call_direct or call_fast bound to the registered
+    // function. Calls
+    // to numbers that are not registered are left to fail at run time. Run after use_intrinsics. Returns the number of
+    // calls bound.
+    std::size_t bind_calls(std::vector<ByteCode>& code, const FunctionTable& func_table);
+}
+
+#endif // _SHREK_OPTIMIZER_H_INCLUDE_GUARD
@@ -0,0 +1,276 @@
+#include "shrek_options.h"
+
+#include <cstdint>
+#include <string_view>
+#include "fmt/core.h"
+
+namespace shrek
+{
+    static bool parse_lexer_backend(std::string_view value, LexerBackend& result);
+    static bool parse_parse_mode(std::string_view value, ParseMode& result);
+    static bool parse_dispatch_mode(std::string_view value, DispatchMode& result);
+    static bool parse_execution_tier(std::string_view value, ExecutionTier& result);
+    static bool parse_size(std::string_view value, std::size_t& result);
+
+    bool parse_options(int argc, const char** argv, RuntimeOptions& result)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string_view arg = argv[i];
+
+            if (arg.substr(0, 2) != "--")
+            {
+                if (!result.code_file.empty())
+                {
+                    fmt::print("Invalid arguments. Unexpected argument \"{}\".", arg);
+                    return false;
+                }
+
+                result.code_file = arg;
+                continue;
+            }
+
+            // Options are in the form "--name" or "--name=value".
+            auto name = arg.substr(2);
+            std::string_view value;
+
+            auto equals = name.find('=');
+            if (equals != std::string_view::npos)
+            {
+                value = name.substr(equals + 1);
+                name = name.substr(0, equals);
+            }
+
+            if (name == "lexer" && parse_lexer_backend(value, result.parse.lexer))
+            {
+                continue;
+            }
+
+            if (name == "parse-mode" && parse_parse_mode(value, result.parse.mode))
+            {
+                continue;
+            }
+
+            if (name == "stats" && value.empty())
+            {
+                result.print_stats = true;
+                continue;
+            }
+
+            if (name == "dispatch" && parse_dispatch_mode(value, result.dispatch))
+            {
+                continue;
+            }
+
+            if (name == "tier" && parse_execution_tier(value, result.tier))
+            {
+                continue;
+            }
+
+            if (name == "no-cache" && value.empty())
+            {
+                result.cache.enabled = false;
+                continue;
+            }
+
+            if (name == "cache-dir" && !value.empty())
+            {
+                result.cache.directory = value;
+                continue;
+            }
+
+            if (name == "emit-bytecode" && !value.empty())
+            {
+                result.emit_byte_code_file = value;
+                continue;
+            }
+
+            if (name == "dump-cfg" && !value.empty())
+            {
+                result.dump_cfg_file = value;
+                continue;
+            }
+
+            if (name == "passes" && is_pass_list(value))
+            {
+                result.passes = value;
+                continue;
+            }
+
+            if (name == "time-passes" && value.empty())
+            {
+                result.time_passes = true;
+                continue;
+            }
+
+            if (name == "profile" && !value.empty())
+            {
+                result.profile_file = value;
+                continue;
+            }
+
+            if (name == "superinstructions" && !value.empty())
+            {
+                result.superinstruction_file = value;
+                continue;
+            }
+
+            if (name == "superinstruction-count" && parse_size(value, result.superinstruction_count))
+            {
+                continue;
+            }
+
+            if (name == "disassemble" && value.empty())
+            {
+                result.disassemble = true;
+                continue;
+            }
+
+            if (name == "trace" && value.empty())
+            {
+                result.trace = true;
+                continue;
+            }
+
+            if (name == "count-steps" && value.empty())
+            {
+                result.count_steps = true;
+                continue;
+            }
+
+            if (name == "jit" && value.empty())
+            {
+                result.jit = true;
+                continue;
+            }
+
+            if (name == "stack-size" && parse_size(value, result.stack_size))
+            {
+                continue;
+            }
+
+            if (name == "max-stack" && parse_size(value, result.max_stack_depth))
+            {
+                continue;
+            }
+
+            if (name == "func-table-size" && parse_size(value, result.func_table_size))
+            {
+                continue;
+            }
+
+            fmt::print("Invalid arguments. Unknown option \"{}\".", arg);
+            return false;
+        }
+
+        if (result.code_file.empty())
+        {
+            fmt::print("Invalid arguments. Missing code file.");
+            return false;
+        }
+
+        return true;
+    }
+
+    static bool parse_lexer_backend(std::string_view value, LexerBackend& result)
+    {
+        if (value == "scalar")
+        {
+            result = LexerBackend::scalar;
+        }
+        else if (value == "simd" && simd_lexer_supported())
+        {
+            result = LexerBackend::simd;
+        }
+        else if (value == "check")
+        {
+            result = LexerBackend::cross_check;
+        }
+        else
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+    static bool parse_parse_mode(std::string_view value, ParseMode& result)
+    {
+        if (value == "stream")
+        {
+            result = ParseMode::streaming;
+        }
+        else if (value == "tree")
+        {
+            result = ParseMode::syntax_tree;
+        }
+        else
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+    static bool parse_dispatch_mode(std::string_view value, DispatchMode& result)
+    {
+        if (value == "switch")
+        {
+            result = DispatchMode::switch_loop;
+        }
+        else if (value == "threaded" && threaded_dispatch_supported())
+        {
+            result = DispatchMode::threaded;
+        }
+        else if (value == "tos")
+        {
+            result = DispatchMode::top_of_stack;
+        }
+        else
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+    static bool parse_execution_tier(std::string_view value, ExecutionTier& result)
+    {
+        if (value == "stack")
+        {
+            result = ExecutionTier::stack;
+        }
+        else if (value == "register")
+        {
+            result = ExecutionTier::register_;
+        }
+        else
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+    static bool parse_size(std::string_view value, std::size_t& result)
+    {
+        if (value.empty())
+        {
+            return false;
+        }
+
+        std::size_t size = 0;
+        for (auto c : value)
+        {
+            if (c < '0' || c > '9' || size > (SIZE_MAX - 9) / 10)
+            {
+                return false;
+            }
+
+            size = size * 10 + (std::size_t)(c - '0');
+        }
+
+        result = size;
+        return true;
+    }
+}
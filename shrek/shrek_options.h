@@ -0,0 +1,59 @@
+#ifndef _SHREK_OPTIONS_H_INCLUDE_GUARD
+#define _SHREK_OPTIONS_H_INCLUDE_GUARD
+
+#include <string>
+
+#include "shrek_bytecode_cache.h"
+#include "shrek_function_table.h"
+#include "shrek_parser.h"
+#include "shrek_pass_manager.h"
+#include "shrek_superinstructions.h"
+#include "shrek_value_stack.h"
+
+namespace shrek
+{
+    enum class DispatchMode
+    {
+        switch_loop,
+        threaded,
+        top_of_stack
+    };
+
+    enum class ExecutionTier
+    {
+        stack,
+        register_
+    };
+
+    // True if the compiler supports labels as values, which threaded dispatch is built on.
+    bool threaded_dispatch_supported();
+
+    struct RuntimeOptions
+    {
+        std::string code_file;
+        ParseOptions parse;
+        CacheOptions cache;
+        std::string emit_byte_code_file;
+        std::string dump_cfg_file;
+        std::string passes = default_pass_list;
+        std::string profile_file;
+        std::string superinstruction_file;
+        DispatchMode dispatch = threaded_dispatch_supported() ? DispatchMode::threaded : DispatchMode::switch_loop;
+        ExecutionTier tier = ExecutionTier::stack;
+        bool print_stats = false;
+        bool disassemble = false;
+        bool trace = false;
+        bool count_steps = false;
+        bool jit = false;
+        bool time_passes = false;
+        std::size_t stack_size = ValueStack::default_capacity;
+        std::size_t max_stack_depth = ValueStack::unlimited_depth;
+        std::size_t func_table_size = FunctionTable::default_dense_size;
+        std::size_t superinstruction_count = default_superinstruction_count;
+    };
+
+    // Parse the command line given to shrek_run. Prints a message and returns false if the arguments are invalid.
+    bool parse_options(int argc, const char** argv, RuntimeOptions& result);
+}
+
+#endif // _SHREK_OPTIONS_H_INCLUDE_GUARD
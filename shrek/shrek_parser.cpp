@@ -1,269 +1,486 @@
-#include "shrek_parser.h"
-
-#include <cassert>
-#include <limits.h>
-#include <optional>
-#include <stack>
-#include <regex>
-#include <unordered_map>
-#include "fmt/format.h"
-
-#include "shrek_types.h"
-#include "shrek_platform_specific.h"
-
-namespace shrek
-{
-    struct ShrekCommands
-    {
-        static constexpr auto push0 = "S";
-        static constexpr auto pop = "H";
-        static constexpr auto bump = "R";
-        static constexpr auto func = "E";
-        static constexpr auto jump = "K";
-    };
-
-    static int get_or_add(std::unordered_map<std::string, int>& map, const std::string& search, int add_value);
-    static std::size_t next_token(const std::string& code, std::size_t index, Token& result);
-    static std::optional<OpCode> get_op_code(const std::string& value);
-    static void parse_command(const std::vector<Token>& tokens, std::size_t& index, SyntaxTree& tree);
-    static void parse_label(const std::vector<Token>& tokens, std::size_t& index, SyntaxTree& tree);
-    static void parse_comment(const std::vector<Token>& tokens, std::size_t& index, SyntaxTree& tree);
-    std::vector<ByteCode> interpret_code_impl(const std::string& code);
-
-    std::vector<ByteCode> interpret_code(const std::string& filename)
-    {
-        std::string code;
-        if (!read_all_text(filename, code))
-        {
-            throw RuntimeError("Failed to read source file");
-        }
-
-        try
-        {
-            return interpret_code_impl(code);
-        }
-        catch (SyntaxError)
-        {
-            //fmt::print("Syntax Error: {} at index {}, token \"{}\"", ex.what(), ex.index(), ex.token());
-            //exit(1);
-            throw;
-        }
-        catch (...)
-        {
-            fmt::print("Interpreter encountered an unexpected exception.");
-            throw;
-        }
-    }
-
-    std::vector<ByteCode> interpret_code_impl(const std::string& code)
-    {
-        // Tokenize code.
-        std::size_t index = 0;
-        std::vector<Token> tokens;
-
-        while (index < code.size())
-        {
-            Token t;
-            index = next_token(code, index, t);
-            tokens.push_back(std::move(t));
-        }
-
-        // Build syntax tree
-        SyntaxTree syntax_tree;
-        index = 0;
-        while (index < tokens.size())
-        {
-            SyntaxTreeNode node;
-
-            switch (tokens[index].token_type)
-            {
-            case TokenType::command:
-                parse_command(tokens, index, syntax_tree);
-                break;
-            case TokenType::label:
-                parse_label(tokens, index, syntax_tree);
-                break;
-            case TokenType::comment:
-                parse_comment(tokens, index, syntax_tree);
-                break;
-            default:
-                // Skip other items in tree
-                ++index;
-                break;
-            }
-        }
-
-        // Build Byte Code
-        std::vector<ByteCode> byte_code;
-        byte_code.reserve(syntax_tree.syntax.size());
-
-        std::unordered_map<std::string, int> label_map;
-
-        for (const auto& node : syntax_tree.syntax)
-        {
-            ByteCode code;
-
-            if (node.token.token_type == TokenType::label)
-            {
-                // Get the label number if already found, otherwise add.
-                code.op_code = OpCode::label;
-                code.a = get_or_add(label_map, node.token.value, (int)label_map.size());
-
-                byte_code.push_back(code);
-            }
-            else if (node.token.token_type == TokenType::command)
-            {
-                auto maybe_op_code = get_op_code(node.token.value);
-                if (!maybe_op_code)
-                {
-                    throw SyntaxError("Invalid command", node.token.index, node.token.value);
-                }
-
-                code.op_code = *maybe_op_code;
-
-                if (maybe_op_code == OpCode::jump)
-                {
-                    if (node.children.empty() || node.children[0].token.token_type != TokenType::label)
-                    {
-                        throw SyntaxError("Jump must be followed by label", node.token.index, node.token.value);
-                    }
-
-                    // Get the label number if already found, otherwise add. The label number is not the actual position,
-                    // so it can be assigned a number before the label op_code is found.
-                    code.a = get_or_add(label_map, node.children[0].token.value, (int)label_map.size());
-                }
-
-                byte_code.push_back(code);
-            }
-        }
-
-        return byte_code;
-    }
-
-    static std::size_t next_token(const std::string& code, std::size_t index, Token& result)
-    {
-        static std::regex label_regex(R"_(![SHREK]+!)_");
-        static std::regex cmd_regex(R"_([SHREK])_");
-        static std::regex whitespace_regex(R"_(\s+)_");
-        static std::regex comment_regex(R"_(#[^\n]*\n?)_");
-
-        std::smatch m;
-        if (std::regex_search(code.begin() + index, code.end(), m, label_regex, std::regex_constants::match_continuous))
-        {
-            result.token_type = TokenType::label;
-        }
-        else if (std::regex_search(code.begin() + index, code.end(), m, cmd_regex, std::regex_constants::match_continuous))
-        {
-            result.token_type = TokenType::command;
-        }
-        else if (std::regex_search(code.begin() + index, code.end(), m, whitespace_regex, std::regex_constants::match_continuous))
-        {
-            result.token_type = TokenType::whitespace;
-        }
-        else if (std::regex_search(code.begin() + index, code.end(), m, comment_regex, std::regex_constants::match_continuous))
-        {
-            result.token_type = TokenType::comment;
-        }
-        else
-        {
-            throw SyntaxError("Invalid token", index, code.substr(index, 1));
-        }
-
-        result.value = m.str();
-        result.index = index;
-
-        return index + result.value.size();
-    }
-
-    static std::optional<OpCode> get_op_code(const std::string& value)
-    {
-        if (value.size() > 0)
-        {
-            switch (value[0])
-            {
-            case 'S':
-                return OpCode::push0;
-            case 'H':
-                return OpCode::pop;
-            case 'R':
-                return OpCode::bump;
-            case 'E':
-                return OpCode::func;
-            case 'K':
-                return OpCode::jump;
-            }
-        }
-
-        return std::nullopt;
-    }
-
-    static void parse_command(const std::vector<Token>& tokens, std::size_t& index, SyntaxTree& tree)
-    {
-        assert(index < tokens.size());
-
-        const auto& token = tokens[index];
-        ++index;
-
-        SyntaxTreeNode node;
-        node.token = token;
-
-        auto op_code_translated = get_op_code(node.token.value);
-        if (!op_code_translated)
-        {
-            throw SyntaxError("Invalid command", node.token.index, node.token.value);
-        }
-
-        if (token.value == ShrekCommands::jump)
-        {
-            if (index < tokens.size() && tokens[index].token_type == TokenType::label)
-            {
-                SyntaxTreeNode child_label;
-                child_label.token = tokens[index];
-                ++index;
-
-                //node.children.push_back(std::make_unique<SyntaxTreeNode>(std::move(child_label)));
-                node.children.push_back(std::move(child_label));
-            }
-            else
-            {
-                throw SyntaxError("Missing label after jump command", node.token.index, node.token.value);
-            }
-        }
-
-        tree.syntax.push_back(std::move(node));
-    }
-
-    static void parse_label(const std::vector<Token>& tokens, std::size_t& index, SyntaxTree& tree)
-    {
-        assert(index < tokens.size());
-
-        SyntaxTreeNode node;
-        node.token = tokens[index];
-        ++index;
-
-        tree.syntax.push_back(std::move(node));
-    }
-
-    static void parse_comment(const std::vector<Token>& tokens, std::size_t& index, SyntaxTree& tree)
-    {
-        assert(index < tokens.size());
-
-        SyntaxTreeNode node;
-        node.token = tokens[index];
-        ++index;
-
-        tree.syntax.push_back(std::move(node));
-    }
-
-    static int get_or_add(std::unordered_map<std::string, int>& map, const std::string& search, int add_value)
-    {
-        auto it = map.find(search);
-        if (it != map.end())
-        {
-            return it->second;
-        }
-
-        map.insert(std::make_pair(search, add_value));
-        return add_value;
-    }
-}
+#include "shrek_parser.h"
+
+#include <cassert>
+#include <cstdint>
+#include <limits.h>
+#include <optional>
+#include <stack>
+#include "fmt/format.h"
+
+#include "shrek_lexer.h"
+#include "shrek_types.h"
+#include "shrek_platform_specific.h"
+
+namespace shrek
+{
+    struct ShrekCommands
+    {
+        static constexpr auto push0 = "S";
+        static constexpr auto pop = "H";
+        static constexpr auto bump = "R";
+        static constexpr auto func = "E";
+        static constexpr auto jump = "K";
+    };
+
+    // Assigns label numbers in order of first use. Labels only use the five SHREK letters, so a label of up to 27
+    // letters is encoded as a bijective base 5 number that fits in 64 bits and is looked up without hashing or copying
+    // the text. Longer labels are keyed by a hash of the text and compared in full. Entries live in one open addressing
+    // array, so interning only allocates when the table grows.
+    class LabelTable
+    {
+    public:
+        int get_or_add(std::string_view label);
+
+    private:
+        struct Entry
+        {
+            std::uint64_t key = 0;
+            std::string_view long_label;
+            int value = -1;
+        };
+
+        static constexpr std::size_t max_encoded_length = 27;
+        static constexpr std::size_t initial_capacity = 64;
+
+        std::vector<Entry> m_entries;
+        std::size_t m_count = 0;
+
+        Entry& find_slot(std::uint64_t key, std::string_view long_label);
+        void grow();
+    };
+
+    static std::optional<OpCode> get_op_code(std::string_view value);
+    static void parse_command(const std::vector<Token>& tokens, std::size_t& index, SyntaxTree& tree);
+    static void parse_label(const std::vector<Token>& tokens, std::size_t& index, SyntaxTree& tree);
+    static void parse_comment(const std::vector<Token>& tokens, std::size_t& index, SyntaxTree& tree);
+    static std::vector<ByteCode> compile_streaming(std::string_view code, LexerBackend backend);
+    static std::vector<ByteCode> compile(std::string_view code, LexerBackend backend, ParseMode mode);
+    static std::vector<ByteCode> cross_check_backends(std::string_view code, ParseMode mode);
+
+    std::vector<ByteCode> interpret_code(const std::string& filename, const ParseOptions& options)
+    {
+        SourceText code;
+        if (!read_all_text(filename, code))
+        {
+            throw RuntimeError("Failed to read source file");
+        }
+
+        try
+        {
+            return interpret_source(code.view(), options);
+        }
+        catch (SyntaxError)
+        {
+            //fmt::print("Syntax Error: {} at index {}, token \"{}\"", ex.what(), ex.index(), ex.token());
+            //exit(1);
+            throw;
+        }
+        catch (...)
+        {
+            fmt::print("Interpreter encountered an unexpected exception.");
+            throw;
+        }
+    }
+
+    std::vector<ByteCode> interpret_source(std::string_view code, const ParseOptions& options)
+    {
+        if (options.lexer == LexerBackend::cross_check)
+        {
+            return cross_check_backends(code, options.mode);
+        }
+
+        return compile(code, options.lexer, options.mode);
+    }
+
+    SyntaxTree parse_syntax_tree(std::string_view code, LexerBackend backend)
+    {
+        const auto& scan = scan_routines(backend);
+
+        // Tokenize code.
+        std::size_t index = 0;
+        std::vector<Token> tokens;
+
+        while (index < code.size())
+        {
+            TokenView t;
+            index = next_token(code, index, scan, t);
+
+            Token token;
+            token.token_type = t.token_type;
+            token.value = t.value;
+            token.index = t.index;
+            tokens.push_back(std::move(token));
+        }
+
+        // Build syntax tree
+        SyntaxTree syntax_tree;
+        index = 0;
+        while (index < tokens.size())
+        {
+            switch (tokens[index].token_type)
+            {
+            case TokenType::command:
+                parse_command(tokens, index, syntax_tree);
+                break;
+            case TokenType::label:
+                parse_label(tokens, index, syntax_tree);
+                break;
+            case TokenType::comment:
+                parse_comment(tokens, index, syntax_tree);
+                break;
+            default:
+                // Skip other items in tree
+                ++index;
+                break;
+            }
+        }
+
+        return syntax_tree;
+    }
+
+    std::vector<ByteCode> emit_byte_code(const SyntaxTree& syntax_tree)
+    {
+        std::vector<ByteCode> byte_code;
+        byte_code.reserve(syntax_tree.syntax.size());
+
+        LabelTable labels;
+
+        for (const auto& node : syntax_tree.syntax)
+        {
+            ByteCode code;
+            code.source_code_index = node.token.index;
+
+            if (node.token.token_type == TokenType::label)
+            {
+                // Get the label number if already found, otherwise add.
+                code.op_code = OpCode::label;
+                code.a = labels.get_or_add(node.token.value);
+
+                byte_code.push_back(code);
+            }
+            else if (node.token.token_type == TokenType::command)
+            {
+                auto maybe_op_code = get_op_code(node.token.value);
+                if (!maybe_op_code)
+                {
+                    throw SyntaxError("Invalid command", node.token.index, node.token.value);
+                }
+
+                code.op_code = *maybe_op_code;
+
+                if (maybe_op_code == OpCode::jump)
+                {
+                    if (node.children.empty() || node.children[0].token.token_type != TokenType::label)
+                    {
+                        throw SyntaxError("Jump must be followed by label", node.token.index, node.token.value);
+                    }
+
+                    // Get the label number if already found, otherwise add. The label number is not the actual position,
+                    // so it can be assigned a number before the label op_code is found.
+                    code.a = labels.get_or_add(node.children[0].token.value);
+                }
+
+                byte_code.push_back(code);
+            }
+        }
+
+        return byte_code;
+    }
+
+    // Compile straight from the code to byte code, without building the token list or syntax tree. Produces the same
+    // byte code and syntax errors as emit_byte_code(parse_syntax_tree(code)).
+    static std::vector<ByteCode> compile_streaming(std::string_view code, LexerBackend backend)
+    {
+        const auto& scan = scan_routines(backend);
+
+        std::vector<ByteCode> byte_code;
+        LabelTable labels;
+        std::optional<SyntaxError> parse_error;
+
+        std::size_t index = 0;
+        TokenView token;
+
+        while (index < code.size())
+        {
+            index = next_token(code, index, scan, token);
+
+            ByteCode byte;
+            byte.source_code_index = token.index;
+
+            if (token.token_type == TokenType::label)
+            {
+                byte.op_code = OpCode::label;
+                byte.a = labels.get_or_add(token.value);
+
+                byte_code.push_back(byte);
+            }
+            else if (token.token_type == TokenType::command)
+            {
+                byte.op_code = *get_op_code(token.value);
+
+                if (byte.op_code == OpCode::jump)
+                {
+                    TokenView label;
+                    if (index < code.size())
+                    {
+                        index = next_token(code, index, scan, label);
+                    }
+
+                    if (label.token_type != TokenType::label)
+                    {
+                        parse_error = SyntaxError("Missing label after jump command", token.index, std::string(token.value));
+                        break;
+                    }
+
+                    byte.a = labels.get_or_add(label.value);
+                }
+
+                byte_code.push_back(byte);
+            }
+        }
+
+        if (parse_error)
+        {
+            // The tree builder only runs once the whole code is tokenized, so an invalid token anywhere in the code
+            // takes priority over the parse error.
+            while (index < code.size())
+            {
+                index = next_token(code, index, scan, token);
+            }
+
+            throw *parse_error;
+        }
+
+        return byte_code;
+    }
+
+    static std::vector<ByteCode> compile(std::string_view code, LexerBackend backend, ParseMode mode)
+    {
+        if (mode == ParseMode::syntax_tree)
+        {
+            return emit_byte_code(parse_syntax_tree(code, backend));
+        }
+
+        return compile_streaming(code, backend);
+    }
+
+    static std::vector<ByteCode> cross_check_backends(std::string_view code, ParseMode mode)
+    {
+        std::vector<ByteCode> scalar_code;
+        std::optional<SyntaxError> scalar_error;
+
+        try
+        {
+            scalar_code = compile(code, LexerBackend::scalar, mode);
+        }
+        catch (const SyntaxError& ex)
+        {
+            scalar_error = ex;
+        }
+
+        std::vector<ByteCode> simd_code;
+        std::optional<SyntaxError> simd_error;
+
+        try
+        {
+            simd_code = compile(code, LexerBackend::simd, mode);
+        }
+        catch (const SyntaxError& ex)
+        {
+            simd_error = ex;
+        }
+
+        if (scalar_error || simd_error)
+        {
+            if (!scalar_error || !simd_error || scalar_error->index() != simd_error->index()
+                || scalar_error->what() != simd_error->what())
+            {
+                throw RuntimeError("Lexer backends disagree on syntax error");
+            }
+
+            throw *scalar_error;
+        }
+
+        if (scalar_code.size() != simd_code.size())
+        {
+            throw RuntimeError("Lexer backends disagree on byte code size");
+        }
+
+        for (std::size_t i = 0; i < scalar_code.size(); ++i)
+        {
+            const auto& lhs = scalar_code[i];
+            const auto& rhs = simd_code[i];
+
+            if (lhs.op_code != rhs.op_code || lhs.a != rhs.a || lhs.source_code_index != rhs.source_code_index)
+            {
+                throw RuntimeError(fmt::format("Lexer backends disagree on byte code at index {}", i));
+            }
+        }
+
+        return scalar_code;
+    }
+
+    static std::optional<OpCode> get_op_code(std::string_view value)
+    {
+        if (value.size() > 0)
+        {
+            switch (value[0])
+            {
+            case 'S':
+                return OpCode::push0;
+            case 'H':
+                return OpCode::pop;
+            case 'R':
+                return OpCode::bump;
+            case 'E':
+                return OpCode::func;
+            case 'K':
+                return OpCode::jump;
+            }
+        }
+
+        return std::nullopt;
+    }
+
+    static void parse_command(const std::vector<Token>& tokens, std::size_t& index, SyntaxTree& tree)
+    {
+        assert(index < tokens.size());
+
+        const auto& token = tokens[index];
+        ++index;
+
+        SyntaxTreeNode node;
+        node.token = token;
+
+        auto op_code_translated = get_op_code(node.token.value);
+        if (!op_code_translated)
+        {
+            throw SyntaxError("Invalid command", node.token.index, node.token.value);
+        }
+
+        if (token.value == ShrekCommands::jump)
+        {
+            if (index < tokens.size() && tokens[index].token_type == TokenType::label)
+            {
+                SyntaxTreeNode child_label;
+                child_label.token = tokens[index];
+                ++index;
+
+                //node.children.push_back(std::make_unique<SyntaxTreeNode>(std::move(child_label)));
+                node.children.push_back(std::move(child_label));
+            }
+            else
+            {
+                throw SyntaxError("Missing label after jump command", node.token.index, node.token.value);
+            }
+        }
+
+        tree.syntax.push_back(std::move(node));
+    }
+
+    static void parse_label(const std::vector<Token>& tokens, std::size_t& index, SyntaxTree& tree)
+    {
+        assert(index < tokens.size());
+
+        SyntaxTreeNode node;
+        node.token = tokens[index];
+        ++index;
+
+        tree.syntax.push_back(std::move(node));
+    }
+
+    static void parse_comment(const std::vector<Token>& tokens, std::size_t& index, SyntaxTree& tree)
+    {
+        assert(index < tokens.size());
+
+        SyntaxTreeNode node;
+        node.token = tokens[index];
+        ++index;
+
+        tree.syntax.push_back(std::move(node));
+    }
+
+    int LabelTable::get_or_add(std::string_view label)
+    {
+        // Drop the "!" delimiters from the label token.
+        auto letters = label.substr(1, label.size() - 2);
+
+        std::uint64_t key = 0;
+        std::string_view long_label;
+
+        if (letters.size() <= max_encoded_length)
+        {
+            for (auto c : letters)
+            {
+                std::uint64_t digit = 0;
+                switch (c)
+                {
+                case 'S': digit = 1; break;
+                case 'H': digit = 2; break;
+                case 'R': digit = 3; break;
+                case 'E': digit = 4; break;
+                case 'K': digit = 5; break;
+                }
+
+                key = key * 5 + digit;
+            }
+        }
+        else
+        {
+            // FNV-1a
+            key = 14695981039346656037ull;
+            for (auto c : letters)
+            {
+                key = (key ^ (unsigned char)c) * 1099511628211ull;
+            }
+
+            long_label = letters;
+        }
+
+        if ((m_count + 1) * 2 > m_entries.size())
+        {
+            grow();
+        }
+
+        auto& entry = find_slot(key, long_label);
+        if (entry.value < 0)
+        {
+            entry.key = key;
+            entry.long_label = long_label;
+            entry.value = (int)m_count++;
+        }
+
+        return entry.value;
+    }
+
+    LabelTable::Entry& LabelTable::find_slot(std::uint64_t key, std::string_view long_label)
+    {
+        auto mask = m_entries.size() - 1;
+        auto slot = (std::size_t)((key * 0x9e3779b97f4a7c15ull) >> 32) & mask;
+
+        for (;;)
+        {
+            auto& entry = m_entries[slot];
+            if (entry.value < 0 || (entry.key == key && entry.long_label == long_label))
+            {
+                return entry;
+            }
+
+            slot = (slot + 1) & mask;
+        }
+    }
+
+    void LabelTable::grow()
+    {
+        std::vector<Entry> old_entries(m_entries.empty() ? initial_capacity : m_entries.size() * 2);
+        old_entries.swap(m_entries);
+
+        for (const auto& entry : old_entries)
+        {
+            if (entry.value >= 0)
+            {
+                find_slot(entry.key, entry.long_label) = entry;
+            }
+        }
+    }
+}
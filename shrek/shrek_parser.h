@@ -1,11 +1,33 @@
-#ifndef _SHREK_INTERPRETER_H_INCLUDE_GUARD
-#define _SHREK_INTERPRETER_H_INCLUDE_GUARD
-
-#include "shrek_types.h"
-
-namespace shrek
-{
-    std::vector<ByteCode> interpret_code(const std::string& filename);
-}
-
-#endif // _SHREK_INTERPRETER_H_INCLUDE_GUARD
+#ifndef _SHREK_INTERPRETER_H_INCLUDE_GUARD
+#define _SHREK_INTERPRETER_H_INCLUDE_GUARD
+
+#include <string_view>
+
+#include "shrek_lexer.h"
+#include "shrek_types.h"
+
+namespace shrek
+{
+    enum class ParseMode
+    {
+        streaming,  // Emit byte code directly while scanning.
+        syntax_tree // Build the token list and syntax tree first. Slower, kept for tooling and comparisons.
+    };
+
+    struct ParseOptions
+    {
+        LexerBackend lexer = simd_lexer_supported() ? LexerBackend::simd : LexerBackend::scalar;
+        ParseMode mode = ParseMode::streaming;
+    };
+
+    std::vector<ByteCode> interpret_code(const std::string& filename, const ParseOptions& options = ParseOptions());
+
+    std::vector<ByteCode> interpret_source(std::string_view code, const ParseOptions& options = ParseOptions());
+
+    // Syntax tree API for tooling. The tree holds a copy of every token, so it is not used to run programs.
+    SyntaxTree parse_syntax_tree(std::string_view code, LexerBackend backend);
+
+    std::vector<ByteCode> emit_byte_code(const SyntaxTree& syntax_tree);
+}
+
+#endif // _SHREK_INTERPRETER_H_INCLUDE_GUARD
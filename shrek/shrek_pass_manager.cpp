@@ -0,0 +1,168 @@
+#include "shrek_pass_manager.h"
+
+#include <chrono>
+#include <optional>
+#include "fmt/format.h"
+
+#include "shrek_cfg.h"
+#include "shrek_ir_passes.h"
+#include "shrek_optimizer.h"
+
+namespace shrek
+{
+    static const Pass builtin_passes[] =
+    {
+        {
+            "fold-constants", "fold constants: removed {} instructions",
+            [](std::vector<ByteCode>& code, const PassContext&) { return fold_constants(code); }
+        },
+        {
+            "specialize-jumps", "specialize jumps: replaced {} jumps",
+            [](std::vector<ByteCode>& code, const PassContext&) { return specialize_jumps(code); }
+        },
+        {
+            "thread-jumps", "thread jumps: threaded {} jumps",
+            [](std::vector<ByteCode>& code, const PassContext&) { return thread_jumps(code); }
+        },
+        {
+            "remove-unreachable", "remove unreachable: removed {} instructions",
+            [](std::vector<ByteCode>& code, const PassContext&) { return remove_unreachable_blocks(code); }
+        },
+        {
+            "remove-unused-labels", "remove unused labels: removed {} labels",
+            [](std::vector<ByteCode>& code, const PassContext&) { return remove_unused_labels(code); }
+        },
+        {
+            "intrinsics", "intrinsics: replaced {} built-in calls",
+            [](std::vector<ByteCode>& code, const PassContext& context)
+            {
+                return use_intrinsics(code, context.func_table);
+            }
+        },
+        {
+            "bind-calls", "bind calls: bound {} call sites",
+            [](std::vector<ByteCode>& code, const PassContext& context) { return bind_calls(code, context.func_table); }
+        },
+        {
+            "propagate-constants", "propagate constants: folded {} instructions and jumps", nullptr,
+            [](IrProgram& program, const PassContext&) { return propagate_constants(program); }
+        },
+        {
+            "dead-code", "dead code: removed {} instructions", nullptr,
+            [](IrProgram& program, const PassContext&) { return remove_dead_values(program); }
+        }
+    };
+
+    using PassClock = std::chrono::steady_clock;
+
+    const Pass* find_pass(std::string_view name)
+    {
+        for (const auto& pass : builtin_passes)
+        {
+            if (name == pass.name)
+            {
+                return &pass;
+            }
+        }
+
+        return nullptr;
+    }
+
+    bool is_pass_list(std::string_view names)
+    {
+        PassManager passes;
+        return passes.add_list(names);
+    }
+
+    void PassManager::add(const Pass& pass)
+    {
+        m_passes.push_back(pass);
+    }
+
+    bool PassManager::add_list(std::string_view names)
+    {
+        std::vector<Pass> passes;
+
+        while (!names.empty())
+        {
+            auto comma = names.find(',');
+            auto name = names.substr(0, comma);
+            names = comma == std::string_view::npos ? std::string_view() : names.substr(comma + 1);
+
+            auto pass = find_pass(name);
+            if (!pass)
+            {
+                return false;
+            }
+
+            passes.push_back(*pass);
+        }
+
+        m_passes.insert(m_passes.end(), passes.begin(), passes.end());
+        return true;
+    }
+
+    void PassManager::run(std::vector<ByteCode>& code, const PassContext& context, bool print_stats,
+        bool time_passes) const
+    {
+        std::optional<IrProgram> program;
+        std::chrono::duration<double, std::milli> total(0);
+
+        auto timed = [&](const char* name, auto&& step)
+        {
+            auto start = PassClock::now();
+            auto result = step();
+
+            std::chrono::duration<double, std::milli> time = PassClock::now() - start;
+            total += time;
+            if (time_passes)
+            {
+                fmt::print(stderr, "pass {}: {:.3f} ms\n", name, time.count());
+            }
+
+            return result;
+        };
+
+        auto lower = [&]()
+        {
+            if (program)
+            {
+                code = timed("lower-ir", [&]() { return lower_ir(*program); });
+                program.reset();
+            }
+        };
+
+        for (const auto& pass : m_passes)
+        {
+            std::size_t changes = 0;
+
+            if (pass.run_ir)
+            {
+                if (!program)
+                {
+                    program = timed("build-ir", [&]() { return build_ir(code); });
+                }
+
+                changes = timed(pass.name, [&]() { return pass.run_ir(*program, context); });
+            }
+            else
+            {
+                lower();
+                changes = timed(pass.name, [&]() { return pass.run_byte_code(code, context); });
+            }
+
+            if (print_stats)
+            {
+                fmt::print(stderr, pass.stats_format, changes);
+                fmt::print(stderr, "\n");
+            }
+        }
+
+        lower();
+
+        if (time_passes)
+        {
+            fmt::print(stderr, "passes: {:.3f} ms\n", total.count());
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef _SHREK_PASS_MANAGER_H_INCLUDE_GUARD
+#define _SHREK_PASS_MANAGER_H_INCLUDE_GUARD
+
+#include <string_view>
+
+#include "shrek_function_table.h"
+#include "shrek_ir.h"
+
+namespace shrek
+{
+    // Passes run when --passes is not given, in order. The passes on the IR are left out until building it is known to
+    // finish on every control flow graph, and only run when listed.
+    constexpr const char* default_pass_list = "fold-constants,specialize-jumps,thread-jumps,remove-unreachable,"
+        "remove-unused-labels,intrinsics,bind-calls";
+
+    // What a pass can look at besides the code.
+    struct PassContext
+    {
+        const FunctionTable& func_table;
+    };
+
+    // An optimization pass, run either on byte code or on the IR. Each returns the number of changes it made.
+    struct Pass
+    {
+        const char* name = nullptr;
+
+        // Line printed under --stats, with the number of changes in place of {}.
+        const char* stats_format = nullptr;
+
+        std::size_t (*run_byte_code)(std::vector<ByteCode>& code, const PassContext& context) = nullptr;
+        std::size_t (*run_ir)(IrProgram& program, const PassContext& context) = nullptr;
+    };
+
+    // Built-in pass with the given name, or nullptr.
+    const Pass* find_pass(std::string_view name);
+
+    // True if names is a comma separated list of built-in passes. An empty list runs no passes.
+    bool is_pass_list(std::string_view names);
+
+    // Runs passes in order on code that is not linked yet. The IR is built before the first of a run of passes on the
+    // IR and lowered after the last, so passes on the IR must leave it valid for the next one.
+    class PassManager
+    {
+    public:
+        // Add a pass to run after the ones already added.
+        void add(const Pass& pass);
+
+        // Add each built-in pass in a comma separated list of names. Returns false, adding none, if a name is unknown.
+        bool add_list(std::string_view names);
+
+        // Prints the stats line of each pass under print_stats, and how long each pass took under time_passes.
+        void run(std::vector<ByteCode>& code, const PassContext& context, bool print_stats, bool time_passes) const;
+
+    private:
+        std::vector<Pass> m_passes;
+    };
+}
+
+#endif // _SHREK_PASS_MANAGER_H_INCLUDE_GUARD
@@ -1,16 +1,49 @@
-#ifndef _SHREK_PLATFORM_SPECIFIC_H_INCLUDE_GUARD
-#define _SHREK_PLATFORM_SPECIFIC_H_INCLUDE_GUARD
-
-#include <string>
-#include <vector>
-
-#include "shrek.h"
-
-namespace shrek
-{
-    bool read_all_text(const std::string& utf8_filename, std::string& result);
-
-    void discover_modules(ShrekHandle* shrek);
-}
-
-#endif // _SHREK_PLATFORM_SPECIFIC_H_INCLUDE_GUARD
+#ifndef _SHREK_PLATFORM_SPECIFIC_H_INCLUDE_GUARD
+#define _SHREK_PLATFORM_SPECIFIC_H_INCLUDE_GUARD
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "shrek.h"
+
+namespace shrek
+{
+    // Contents of a file loaded by read_all_text. Depending on the platform the text is either memory mapped or read
+    // into an owned buffer, so it must stay alive for as long as the view is used.
+    class SourceText
+    {
+    public:
+        SourceText() = default;
+        SourceText(const SourceText&) = delete;
+        SourceText& operator=(const SourceText&) = delete;
+        ~SourceText();
+
+        std::string_view view() const { return std::string_view(m_data, m_size); }
+
+    private:
+        friend bool read_all_text(const std::string& utf8_filename, SourceText& result);
+
+        void release();
+
+        const char* m_data = nullptr;
+        std::size_t m_size = 0;
+        void* m_mapping = nullptr;
+        std::string m_buffer;
+    };
+
+    bool read_all_text(const std::string& utf8_filename, SourceText& result);
+
+    void discover_modules(ShrekHandle* shrek);
+
+    // Peak resident memory of the process in bytes, or 0 if it is not available.
+    std::size_t peak_memory_usage();
+
+    // Memory for machine code generated at run time. It can be written once allocated, and protect_executable_memory
+    // then makes it executable and read only. Returns nullptr if no memory could be allocated.
+    void* allocate_executable_memory(std::size_t size);
+    bool protect_executable_memory(void* memory, std::size_t size);
+    void free_executable_memory(void* memory, std::size_t size);
+}
+
+#endif // _SHREK_PLATFORM_SPECIFIC_H_INCLUDE_GUARD
@@ -0,0 +1,513 @@
+#include "shrek_register_tier.h"
+
+#include <algorithm>
+#include <optional>
+
+#include "shrek_stack_depth.h"
+
+namespace shrek
+{
+    // Stack size that is not known at translation time, such as at a label register instructions jump to.
+    constexpr std::size_t unknown_size = unbounded_depth;
+
+    // Arithmetic on constants wraps, the same as the instructions it replaces do in practice.
+    static int wrap_add(int lhs, int rhs) { return (int)((unsigned)lhs + (unsigned)rhs); }
+
+    static int wrap_subtract(int lhs, int rhs) { return (int)((unsigned)lhs - (unsigned)rhs); }
+
+    static int wrap_multiply(int lhs, int rhs) { return (int)((unsigned)lhs * (unsigned)rhs); }
+
+    // Walks the code once, keeping the depth and the values known at translation time. Constants are only written to
+    // their register when something reads the register itself: control flow that joins, or an instruction that runs
+    // against the stack.
+    class RegisterTranslator
+    {
+    public:
+        RegisterTranslator(const std::vector<ByteCode>& code);
+
+        std::vector<ByteCode> translate(RegisterTierResult& result);
+
+    private:
+        const std::vector<ByteCode>& m_code;
+        std::vector<StackDepthRange> m_depths;
+
+        // First instruction run after a jump to each label, or m_code.size() for labels that leave the program.
+        std::vector<std::size_t> m_label_targets;
+
+        std::vector<ByteCode> m_out;
+
+        // Source index given to the instructions emitted for the instruction being translated.
+        std::size_t m_source_index = 0;
+
+        // Depth and known values while translating into registers. A register without a value holds what the program
+        // left in it.
+        bool m_in_registers = false;
+        std::size_t m_depth = 0;
+        std::vector<std::optional<int>> m_values;
+
+        // Size the stack actually has, which only changes when reg_sync or an instruction on the stack runs.
+        std::size_t m_stack_size = unknown_size;
+
+        RegisterTierResult m_result;
+
+        bool in_registers(std::size_t index) const;
+        std::size_t next_instruction(std::size_t index) const;
+        std::size_t label_target(int label) const;
+
+        void enter(std::size_t index, bool after_label);
+        void leave(std::size_t successor);
+        void flush();
+        void sync();
+
+        void translate_instruction(std::size_t index);
+        void push_value(std::optional<int> value);
+        void add_to_top(const ByteCode& byte, int value);
+        void unary(const ByteCode& byte, OpCode op_code, int value);
+        void binary(const ByteCode& byte, OpCode op_code);
+        void clone(const ByteCode& byte);
+        void conditional_jump(std::size_t index, OpCode op_code);
+        void jump(const ByteCode& byte);
+        void on_stack(const ByteCode& byte);
+        void emit(OpCode op_code, int b, int c, int a);
+    };
+
+    RegisterTierResult translate_to_registers(std::vector<ByteCode>& code)
+    {
+        RegisterTierResult result;
+
+        RegisterTranslator translator(code);
+        code = translator.translate(result);
+
+        return result;
+    }
+
+    RegisterTranslator::RegisterTranslator(const std::vector<ByteCode>& code)
+        : m_code(code)
+        , m_depths(stack_depths(code))
+    {
+        // A label defined more than once lands on its last definition, the same as the linker.
+        for (std::size_t i = 0; i < m_code.size(); ++i)
+        {
+            if (m_code[i].op_code == OpCode::label)
+            {
+                if ((std::size_t)m_code[i].a >= m_label_targets.size())
+                {
+                    m_label_targets.resize((std::size_t)m_code[i].a + 1, m_code.size());
+                }
+
+                m_label_targets[m_code[i].a] = next_instruction(i);
+            }
+        }
+    }
+
+    std::vector<ByteCode> RegisterTranslator::translate(RegisterTierResult& result)
+    {
+        bool after_label = false;
+
+        for (std::size_t i = 0; i < m_code.size(); ++i)
+        {
+            const auto& byte = m_code[i];
+            m_source_index = byte.source_code_index;
+
+            if (byte.op_code == OpCode::label)
+            {
+                if (m_in_registers)
+                {
+                    leave(next_instruction(i));
+                }
+
+                m_out.push_back(byte);
+                after_label = true;
+                continue;
+            }
+
+            ++m_result.before;
+
+            if (!in_registers(i))
+            {
+                if (m_in_registers)
+                {
+                    leave(i);
+                }
+
+                m_out.push_back(byte);
+                ++m_result.stack;
+                after_label = false;
+                continue;
+            }
+
+            if (!m_in_registers)
+            {
+                enter(i, after_label);
+            }
+
+            after_label = false;
+            translate_instruction(i);
+        }
+
+        if (m_in_registers)
+        {
+            leave(m_code.size());
+        }
+
+        m_result.after = (std::size_t)std::count_if(m_out.begin(), m_out.end(),
+            [](const ByteCode& byte) { return byte.op_code != OpCode::label; });
+
+        result = m_result;
+        return std::move(m_out);
+    }
+
+    bool RegisterTranslator::in_registers(std::size_t index) const
+    {
+        return index < m_code.size() && m_code[index].op_code != OpCode::label && m_depths[index].exact();
+    }
+
+    std::size_t RegisterTranslator::next_instruction(std::size_t index) const
+    {
+        while (index < m_code.size() && m_code[index].op_code == OpCode::label)
+        {
+            ++index;
+        }
+
+        return index;
+    }
+
+    std::size_t RegisterTranslator::label_target(int label) const
+    {
+        if (label < 0 || (std::size_t)label >= m_label_targets.size())
+        {
+            return m_code.size();
+        }
+
+        return m_label_targets[label];
+    }
+
+    void RegisterTranslator::enter(std::size_t index, bool after_label)
+    {
+        // Code on the stack always leaves the stack the right size. After a label the code may also have been reached
+        // from register instructions, which do not.
+        m_in_registers = true;
+        m_depth = m_depths[index].min;
+        m_values.assign(m_depth, std::nullopt);
+        m_stack_size = after_label ? unknown_size : m_depth;
+        m_result.registers = std::max(m_result.registers, m_depth);
+    }
+
+    void RegisterTranslator::leave(std::size_t successor)
+    {
+        flush();
+
+        if (!in_registers(successor))
+        {
+            sync();
+        }
+
+        m_in_registers = false;
+    }
+
+    void RegisterTranslator::flush()
+    {
+        for (std::size_t i = 0; i < m_depth; ++i)
+        {
+            if (m_values[i])
+            {
+                emit(OpCode::reg_set, (int)i, 0, *m_values[i]);
+                m_values[i].reset();
+            }
+        }
+    }
+
+    void RegisterTranslator::sync()
+    {
+        if (m_stack_size != m_depth)
+        {
+            emit(OpCode::reg_sync, 0, 0, (int)m_depth);
+            m_stack_size = m_depth;
+        }
+    }
+
+    void RegisterTranslator::translate_instruction(std::size_t index)
+    {
+        const auto& byte = m_code[index];
+
+        switch (byte.op_code)
+        {
+        case OpCode::push0:
+        case OpCode::push_const:
+            push_value(byte.a);
+            break;
+        case OpCode::pop:
+        case OpCode::pop_unchecked:
+            if (m_depth < 1)
+            {
+                on_stack(byte);
+                return;
+            }
+
+            m_values.pop_back();
+            --m_depth;
+            break;
+        case OpCode::bump:
+        case OpCode::bump_unchecked:
+            add_to_top(byte, 1);
+            return;
+        case OpCode::add_const:
+        case OpCode::add_const_unchecked:
+            add_to_top(byte, byte.a);
+            return;
+        case OpCode::double_:
+            unary(byte, OpCode::reg_mul_imm, 2);
+            return;
+        case OpCode::negate:
+            unary(byte, OpCode::reg_rsub_imm, 0);
+            return;
+        case OpCode::add:
+        case OpCode::add_unchecked:
+            binary(byte, OpCode::reg_add);
+            return;
+        case OpCode::subtract:
+        case OpCode::subtract_unchecked:
+            binary(byte, OpCode::reg_sub);
+            return;
+        case OpCode::multiply:
+        case OpCode::multiply_unchecked:
+            binary(byte, OpCode::reg_mul);
+            return;
+        case OpCode::clone:
+            clone(byte);
+            return;
+        case OpCode::jz:
+        case OpCode::jz_unchecked:
+            conditional_jump(index, OpCode::reg_jz);
+            return;
+        case OpCode::jneg:
+        case OpCode::jneg_unchecked:
+            conditional_jump(index, OpCode::reg_jneg);
+            return;
+        case OpCode::jmp:
+            jump(byte);
+            return;
+        default:
+            on_stack(byte);
+            return;
+        }
+
+        ++m_result.translated;
+    }
+
+    void RegisterTranslator::push_value(std::optional<int> value)
+    {
+        m_values.push_back(value);
+        ++m_depth;
+        m_result.registers = std::max(m_result.registers, m_depth);
+    }
+
+    void RegisterTranslator::add_to_top(const ByteCode& byte, int value)
+    {
+        if (m_depth < 1)
+        {
+            on_stack(byte);
+            return;
+        }
+
+        auto top = m_depth - 1;
+        if (m_values[top])
+        {
+            m_values[top] = wrap_add(*m_values[top], value);
+        }
+        else
+        {
+            emit(OpCode::reg_add_imm, (int)top, (int)top, value);
+        }
+
+        ++m_result.translated;
+    }
+
+    void RegisterTranslator::unary(const ByteCode& byte, OpCode op_code, int value)
+    {
+        if (m_depth < 1)
+        {
+            on_stack(byte);
+            return;
+        }
+
+        auto top = m_depth - 1;
+        if (m_values[top])
+        {
+            m_values[top] = op_code == OpCode::reg_mul_imm ? wrap_multiply(*m_values[top], value)
+                : wrap_subtract(value, *m_values[top]);
+        }
+        else
+        {
+            emit(op_code, (int)top, (int)top, value);
+        }
+
+        ++m_result.translated;
+    }
+
+    void RegisterTranslator::binary(const ByteCode& byte, OpCode op_code)
+    {
+        if (m_depth < 2)
+        {
+            on_stack(byte);
+            return;
+        }
+
+        auto lhs = m_depth - 2;
+        auto rhs = m_depth - 1;
+        const auto& lhs_value = m_values[lhs];
+        const auto& rhs_value = m_values[rhs];
+
+        if (lhs_value && rhs_value)
+        {
+            switch (op_code)
+            {
+            case OpCode::reg_add:
+                m_values[lhs] = wrap_add(*lhs_value, *rhs_value);
+                break;
+            case OpCode::reg_sub:
+                m_values[lhs] = wrap_subtract(*lhs_value, *rhs_value);
+                break;
+            default:
+                m_values[lhs] = wrap_multiply(*lhs_value, *rhs_value);
+                break;
+            }
+        }
+        else if (rhs_value)
+        {
+            switch (op_code)
+            {
+            case OpCode::reg_add:
+                emit(OpCode::reg_add_imm, (int)lhs, (int)lhs, *rhs_value);
+                break;
+            case OpCode::reg_sub:
+                emit(OpCode::reg_add_imm, (int)lhs, (int)lhs, wrap_subtract(0, *rhs_value));
+                break;
+            default:
+                emit(OpCode::reg_mul_imm, (int)lhs, (int)lhs, *rhs_value);
+                break;
+            }
+        }
+        else if (lhs_value)
+        {
+            switch (op_code)
+            {
+            case OpCode::reg_add:
+                emit(OpCode::reg_add_imm, (int)lhs, (int)rhs, *lhs_value);
+                break;
+            case OpCode::reg_sub:
+                emit(OpCode::reg_rsub_imm, (int)lhs, (int)rhs, *lhs_value);
+                break;
+            default:
+                emit(OpCode::reg_mul_imm, (int)lhs, (int)rhs, *lhs_value);
+                break;
+            }
+
+            m_values[lhs].reset();
+        }
+        else
+        {
+            emit(op_code, (int)lhs, (int)lhs, (int)rhs);
+        }
+
+        m_values.pop_back();
+        --m_depth;
+        ++m_result.translated;
+    }
+
+    void RegisterTranslator::clone(const ByteCode& byte)
+    {
+        if (m_depth < 1)
+        {
+            on_stack(byte);
+            return;
+        }
+
+        auto top = m_depth - 1;
+        auto value = m_values[top];
+        if (!value)
+        {
+            emit(OpCode::reg_move, (int)m_depth, (int)top, 0);
+        }
+
+        push_value(value);
+        ++m_result.translated;
+    }
+
+    void RegisterTranslator::conditional_jump(std::size_t index, OpCode op_code)
+    {
+        const auto& byte = m_code[index];
+
+        if (m_depth < 1)
+        {
+            on_stack(byte);
+            return;
+        }
+
+        auto top = m_depth - 1;
+        if (m_values[top])
+        {
+            // Decided at translation time: either an unconditional jump or nothing at all.
+            auto taken = op_code == OpCode::reg_jz ? *m_values[top] == 0 : *m_values[top] < 0;
+            if (taken)
+            {
+                jump(byte);
+            }
+            else
+            {
+                ++m_result.translated;
+            }
+
+            return;
+        }
+
+        flush();
+
+        if (!in_registers(label_target(byte.a)) || !in_registers(next_instruction(index + 1)))
+        {
+            sync();
+        }
+
+        emit(op_code, (int)top, 0, byte.a);
+        ++m_result.translated;
+    }
+
+    void RegisterTranslator::jump(const ByteCode& byte)
+    {
+        flush();
+
+        if (!in_registers(label_target(byte.a)))
+        {
+            sync();
+        }
+
+        emit(OpCode::jmp, 0, 0, byte.a);
+        ++m_result.translated;
+
+        // Anything before the next label is never run.
+        m_in_registers = false;
+    }
+
+    void RegisterTranslator::on_stack(const ByteCode& byte)
+    {
+        flush();
+        sync();
+
+        m_out.push_back(byte);
+        ++m_result.stack;
+
+        // The instruction leaves the stack the right size, and the depth after it may not be known.
+        m_in_registers = false;
+    }
+
+    void RegisterTranslator::emit(OpCode op_code, int b, int c, int a)
+    {
+        ByteCode result;
+        result.source_code_index = m_source_index;
+        result.op_code = op_code;
+        result.a = a;
+        result.b = b;
+        result.c = c;
+        m_out.push_back(result);
+    }
+}
@@ -0,0 +1,31 @@
+#ifndef _SHREK_REGISTER_TIER_H_INCLUDE_GUARD
+#define _SHREK_REGISTER_TIER_H_INCLUDE_GUARD
+
+#include "shrek_types.h"
+
+namespace shrek
+{
+    struct RegisterTierResult
+    {
+        // Instructions translated to register instructions, and instructions left to run against the stack.
+        std::size_t translated = 0;
+        std::size_t stack = 0;
+
+        // Instructions before and after the translation, not counting labels.
+        std::size_t before = 0;
+        std::size_t after = 0;
+
+        // Registers used. The stack must have room for this many values before the program runs.
+        std::size_t registers = 0;
+    };
+
+    // Translate code that is not linked yet into register instructions, wherever the stack depth before an instruction
+    // is the same on every path. The stack slot at each depth becomes a register, so pushes of constants, pops and
+    // jumps on a constant disappear and arithmetic becomes three address instructions. Instructions where the depth is
+    // not known, and those that need the whole stack such as function calls, still run against the stack. The stack
+    // size is only written before them, and before leaving the program, so the stack does not reflect the program while
+    // register instructions run. Run after check_stack_depth.
+    RegisterTierResult translate_to_registers(std::vector<ByteCode>& code);
+}
+
+#endif // _SHREK_REGISTER_TIER_H_INCLUDE_GUARD
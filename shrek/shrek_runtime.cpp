@@ -1,311 +1,1914 @@
-#include "shrek_runtime.h"
-
-#include <cassert>
-#include <stack>
-#include "fmt/core.h"
-
-#include "shrek.h"
-#include "shrek_parser.h"
-#include "shrek_platform_specific.h"
-
-namespace shrek
-{
-    constexpr auto npos = std::numeric_limits<std::size_t>::max();
-    constexpr auto jump_table_default_size = 8;
-
-    ShrekRuntime::ShrekRuntime(ShrekHandle* owning_handle)
-        : m_owning_handle(owning_handle)
-    {
-
-    }
-
-    int ShrekRuntime::run(int argc, const char** argv)
-    {
-        // TODO: Actual argument support.
-        if (argc < 2)
-        {
-            fmt::print("Invalid arguments. Missing code file.");
-            return 1;
-        }
-
-        try
-        {
-            m_code = shrek::interpret_code(argv[1]);
-
-            // Try to discover extension modules before execution.
-            discover_modules(m_owning_handle);
-
-            build_jump_table();
-            return main_loop();
-        }
-        catch (const SyntaxError& ex)
-        {
-            fmt::print("Syntax Error: {} at index {}, token \"{}\"", ex.what(), ex.index(), ex.token());
-            return 1;
-        }
-        catch (const RuntimeError& ex)
-        {
-            // TODO: can get current runtime state from instance.
-            fmt::print("Runtime error: {}", ex.what());
-
-            if (m_hooks)
-            {
-                m_hooks->on_runtime_error();
-            }
-
-            return 1;
-        }
-        catch (...)
-        {
-            fmt::print("Runtime encountered an unexpected exception");
-            return 256;
-        }
-    }
-
-    void ShrekRuntime::set_hooks(RuntimeHooks* hooks)
-    {
-        m_hooks = hooks;
-    }
-
-    void ShrekRuntime::build_jump_table()
-    {
-        m_jump_table.clear();
-        m_jump_table.resize(jump_table_default_size, npos);
-
-        for (std::size_t i = 0; i < m_code.size(); ++i)
-        {
-            const auto& code = m_code[i];
-            if (code.op_code == OpCode::label)
-            {
-                if ((std::size_t)code.a + 1 > m_jump_table.size())
-                {
-                    m_jump_table.resize(code.a + 1, npos);
-                }
-
-                m_jump_table[code.a] = i + 1; // Jump past label to reduce by one operation.
-            }
-        }
-    }
-
-    const ByteCode& ShrekRuntime::curr_code() const
-    {
-        if (m_program_counter < m_code.size())
-        {
-            return m_code[m_program_counter];
-        }
-
-        throw RuntimeError("Program counter at invalid position");
-    }
-
-    bool ShrekRuntime::register_function(int func_number, ShrekFunc func)
-    {
-        if (m_func_table.count(func_number) > 0)
-        {
-            return false;
-        }
-
-        m_func_table[func_number] = func;
-        return true;
-    }
-
-    void ShrekRuntime::set_func_exception(const std::string& value)
-    {
-        m_func_exception = value;
-    }
-
-    int ShrekRuntime::main_loop()
-    {
-        while (m_program_counter < m_code.size())
-        {
-            if (m_hooks)
-            {
-                m_hooks->on_step();
-            }
-
-            switch (curr_code().op_code)
-            {
-            case OpCode::label:
-            case OpCode::no_op:
-                step_program();
-                break;
-            case OpCode::push0:
-                op_push0();
-                break;
-            case OpCode::pop:
-                op_pop();
-                break;
-            case OpCode::bump:
-                op_bump();
-                break;
-            case OpCode::func:
-                op_func();
-                break;
-            case OpCode::jump:
-                op_jump();
-                break;
-            case OpCode::push_const:
-                op_push_const();
-                break;
-            default:
-                throw RuntimeError("Invalid operation");
-            }
-        }
-
-        int exit_code = 0;
-        if (!m_stack.empty())
-        {
-            exit_code = m_stack.top();
-        }
-
-        return exit_code;
-    }
-
-    void ShrekRuntime::step_program()
-    {
-        ++m_program_counter;
-    }
-
-    std::size_t ShrekRuntime::get_jump_location(int label_num)
-    {
-        if ((std::size_t)label_num < m_jump_table.size())
-        {
-            // If label not defined, npos will be returned, which will terminate the program.
-            return m_jump_table[label_num];
-        }
-
-        return npos;
-    }
-
-    void ShrekRuntime::op_push0()
-    {
-        m_stack.push(0);
-        step_program();
-    }
-
-    void ShrekRuntime::op_pop()
-    {
-        if (m_stack.empty())
-        {
-            throw RuntimeError("Stack is empty");
-        }
-
-        m_stack.pop();
-
-        step_program();
-    }
-
-    void ShrekRuntime::op_bump()
-    {
-        if (m_stack.empty())
-        {
-            throw RuntimeError("Stack is empty");
-        }
-
-        auto val = m_stack.top();
-        m_stack.pop();
-
-        ++val;
-        m_stack.push(val);
-
-        step_program();
-    }
-
-    void ShrekRuntime::op_func()
-    {
-        if (m_stack.empty())
-        {
-            throw RuntimeError("Stack is empty");
-        }
-
-        auto func_num = m_stack.top();
-        m_stack.pop();
-
-        auto it = m_func_table.find(func_num);
-        if (it != m_func_table.end())
-        {
-            m_func_exception.clear();
-
-            int rc = it->second(m_owning_handle);
-            if (rc != SHREK_OK)
-            {
-                if (m_func_exception.empty())
-                {
-                    m_func_exception = "registered function did not set exception text";
-                }
-
-                throw RuntimeError(fmt::format("Error running function {}: {}", func_num, m_func_exception));
-            }
-        }
-        else
-        {
-            throw RuntimeError(fmt::format("Function number {} not registered", func_num));
-        }
-
-        step_program();
-    }
-
-    void ShrekRuntime::op_jump()
-    {
-        constexpr auto jump = 0;
-        constexpr auto jump_0 = 1;
-        constexpr auto jump_neg = 2;
-
-        if (m_stack.empty())
-        {
-            throw RuntimeError("Stack is empty");
-        }
-
-        // Top of m_stack indicates jump type.
-        auto s0 = m_stack.top();
-        m_stack.pop();
-
-        if (s0 == jump)
-        {
-            m_program_counter = get_jump_location(curr_code().a);
-        }
-        else if(s0 == jump_0)
-        {
-            if (m_stack.empty())
-            {
-                throw RuntimeError("jump0 requires value on m_stack after jump type");
-            }
-
-            auto s1 = m_stack.top();
-            if (s1 == 0)
-            {
-                m_program_counter = get_jump_location(curr_code().a);
-            }
-            else
-            {
-                step_program();
-            }
-        }
-        else if (s0 == jump_neg)
-        {
-            if (m_stack.empty())
-            {
-                throw RuntimeError("jump_neg requires value on m_stack after jump type");
-            }
-
-            auto s1 = m_stack.top();
-            if (s1 < 0)
-            {
-                m_program_counter = get_jump_location(curr_code().a);
-            }
-            else
-            {
-                step_program();
-            }
-        }
-        else
-        {
-            throw RuntimeError("Invalid jump type");
-        }
-    }
-
-    void ShrekRuntime::op_push_const()
-    {
-        m_stack.push(curr_code().a);
-        step_program();
-    }
-}
+#include "shrek_runtime.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <type_traits>
+#include "fmt/core.h"
+
+#include "shrek.h"
+#include "shrek_builtins.h"
+#include "shrek_bytecode_cache.h"
+#include "shrek_cfg.h"
+#include "shrek_disassembler.h"
+#include "shrek_linker.h"
+#include "shrek_pass_manager.h"
+#include "shrek_platform_specific.h"
+#include "shrek_register_tier.h"
+#include "shrek_stack_depth.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SHREK_THREADED_DISPATCH
+#endif
+
+namespace shrek
+{
+    // Error text for a function that fails without setting any, which is also how every built-in fails.
+    static constexpr auto missing_func_exception = "registered function did not set exception text";
+
+    bool threaded_dispatch_supported()
+    {
+#ifdef SHREK_THREADED_DISPATCH
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    ShrekRuntime::ShrekRuntime(ShrekHandle* owning_handle)
+        : m_owning_handle(owning_handle)
+    {
+
+    }
+
+    int ShrekRuntime::run(int argc, const char** argv)
+    {
+        m_options = RuntimeOptions();
+        if (!parse_options(argc, argv, m_options))
+        {
+            return 1;
+        }
+
+        try
+        {
+            m_stack.reset(m_options.stack_size, m_options.max_stack_depth);
+            m_func_table.set_dense_size(m_options.func_table_size);
+
+            auto parse_start = std::chrono::steady_clock::now();
+            auto loaded = load_byte_code(m_options.code_file, m_options.parse, m_options.cache);
+            m_code = std::move(loaded.code);
+
+            if (m_options.print_stats)
+            {
+                std::chrono::duration<double, std::milli> parse_time = std::chrono::steady_clock::now() - parse_start;
+                fmt::print(stderr, "{}: {:.3f} ms, {} byte codes, peak memory {} KiB\n", loaded.from_cache ? "load" : "parse",
+                    parse_time.count(), m_code.size(), peak_memory_usage() / 1024);
+            }
+
+            if (!m_options.emit_byte_code_file.empty())
+            {
+                if (!write_byte_code_file(m_options.emit_byte_code_file, m_code, loaded.key))
+                {
+                    throw RuntimeError("Failed to write byte code file");
+                }
+
+                return 0;
+            }
+
+            // Try to discover extension modules before execution. Passes that bind calls need them registered.
+            discover_modules(m_owning_handle);
+
+            PassManager passes;
+            passes.add_list(m_options.passes);
+            passes.run(m_code, PassContext{ m_func_table }, m_options.print_stats, m_options.time_passes);
+
+            auto depth = check_stack_depth(m_code);
+            if (depth.max_depth != unbounded_depth)
+            {
+                m_stack.reserve(m_options.max_stack_depth == ValueStack::unlimited_depth ? depth.max_depth
+                    : std::min(depth.max_depth, m_options.max_stack_depth));
+            }
+
+            if (m_options.print_stats)
+            {
+                if (depth.max_depth == unbounded_depth)
+                {
+                    fmt::print(stderr, "stack depth: {} unchecked instructions, maximum depth unbounded\n", depth.unchecked);
+                }
+                else
+                {
+                    fmt::print(stderr, "stack depth: {} unchecked instructions, maximum depth {}\n", depth.unchecked,
+                        depth.max_depth);
+                }
+            }
+
+            // Debuggers look at the stack between instructions, which register instructions do not keep up to date.
+            if (m_options.tier == ExecutionTier::register_ && !m_hooks)
+            {
+                auto translated = m_code;
+                auto tier = translate_to_registers(translated);
+
+                // Register instructions do not check --max-stack, so they are only used when every register fits.
+                auto fits = m_options.max_stack_depth == ValueStack::unlimited_depth
+                    || tier.registers <= m_options.max_stack_depth;
+                if (fits)
+                {
+                    m_code = std::move(translated);
+                    m_stack.reserve(tier.registers);
+                }
+
+                if (m_options.print_stats && fits)
+                {
+                    fmt::print(stderr, "register tier: {} instructions in registers, {} on the stack, {} instructions "
+                        "became {}, {} registers\n", tier.translated, tier.stack, tier.before, tier.after, tier.registers);
+                }
+                else if (m_options.print_stats)
+                {
+                    fmt::print(stderr, "register tier: not used, {} registers do not fit the maximum stack depth\n",
+                        tier.registers);
+                }
+            }
+
+            if (!m_options.dump_cfg_file.empty() && !write_cfg_file(m_options.dump_cfg_file, m_code))
+            {
+                throw RuntimeError("Failed to write control flow graph file");
+            }
+
+            link_byte_code(m_code);
+
+            // Tracing, counting steps and profiling need the interpreter, as does a debugger.
+            if (m_options.jit && !m_hooks && !m_options.trace && !m_options.count_steps
+                && m_options.profile_file.empty())
+            {
+                compile_program();
+            }
+
+            // A profiling run counts the instructions superinstructions would replace, and a debugger steps through them
+            // one at a time. Compiled code already runs them without dispatches.
+            if (!m_options.superinstruction_file.empty() && m_options.profile_file.empty() && !m_hooks && !m_jit)
+            {
+                load_superinstructions();
+            }
+
+            if (m_options.disassemble)
+            {
+                fmt::print("{}", disassemble(m_code));
+                return 0;
+            }
+
+            m_bound_calls = 0;
+            m_dynamic_calls = 0;
+
+            auto execute_start = std::chrono::steady_clock::now();
+            auto result = execute();
+            write_profile();
+
+            if (m_options.print_stats)
+            {
+                std::chrono::duration<double, std::milli> execute_time = std::chrono::steady_clock::now() - execute_start;
+                fmt::print(stderr, "execute: {:.3f} ms\n", execute_time.count());
+                fmt::print(stderr, "calls: {} bound, {} dynamic\n", m_bound_calls, m_dynamic_calls);
+            }
+
+            return result;
+        }
+        catch (const SyntaxError& ex)
+        {
+            fmt::print("Syntax Error: {} at index {}, token \"{}\"", ex.what(), ex.index(), ex.token());
+            return 1;
+        }
+        catch (const RuntimeError& ex)
+        {
+            // TODO: can get current runtime state from instance.
+            fmt::print("Runtime error: {}", ex.what());
+
+            // Programs that end with an error are profiled up to it.
+            write_profile();
+
+            if (m_hooks)
+            {
+                m_hooks->on_runtime_error();
+            }
+
+            return 1;
+        }
+        catch (...)
+        {
+            fmt::print("Runtime encountered an unexpected exception");
+            return 256;
+        }
+    }
+
+    void ShrekRuntime::set_hooks(RuntimeHooks* hooks)
+    {
+        m_hooks = hooks;
+    }
+
+    const ByteCode& ShrekRuntime::curr_code() const
+    {
+        if (m_program_counter < m_code.size())
+        {
+            return m_code[m_program_counter];
+        }
+
+        throw RuntimeError("Program counter at invalid position");
+    }
+
+    bool ShrekRuntime::register_function(int func_number, const FunctionEntry& function)
+    {
+        if (!m_func_table.add(func_number, function))
+        {
+            return false;
+        }
+
+        if (m_fast_results.size() < (std::size_t)function.result_count)
+        {
+            m_fast_results.resize((std::size_t)function.result_count);
+        }
+
+        // Functions can be registered while a program runs, so bound call sites are resolved again.
+        rebind_calls();
+
+        return true;
+    }
+
+    void ShrekRuntime::set_func_exception(const std::string& value)
+    {
+        m_func_exception = value;
+    }
+
+    // Interpreter loop policies. Each loop is instantiated once per policy, so a run without hooks has no per step work.
+    struct ShrekRuntime::NoHooks
+    {
+        explicit NoHooks(ShrekRuntime&) {}
+
+        inline void on_step() {}
+
+        inline void on_finish() {}
+    };
+
+    struct ShrekRuntime::StepHooks
+    {
+        ShrekRuntime& runtime;
+
+        explicit StepHooks(ShrekRuntime& runtime) : runtime(runtime) {}
+
+        inline void on_step() { runtime.m_hooks->on_step(); }
+
+        inline void on_finish() {}
+    };
+
+    struct ShrekRuntime::StepCounting
+    {
+        ShrekRuntime& runtime;
+        std::size_t steps = 0;
+
+        explicit StepCounting(ShrekRuntime& runtime) : runtime(runtime) {}
+
+        inline void on_step() { ++steps; }
+
+        void on_finish() { fmt::print(stderr, "steps: {}\n", steps); }
+    };
+
+    struct ShrekRuntime::Profiling
+    {
+        ShrekRuntime& runtime;
+
+        explicit Profiling(ShrekRuntime& runtime) : runtime(runtime) {}
+
+        inline void on_step() { ++runtime.m_profile[runtime.m_program_counter]; }
+
+        inline void on_finish() {}
+    };
+
+    struct ShrekRuntime::Tracing
+    {
+        ShrekRuntime& runtime;
+
+        explicit Tracing(ShrekRuntime& runtime) : runtime(runtime) {}
+
+        void on_step()
+        {
+            const auto& code = runtime.m_code[runtime.m_program_counter];
+            const auto& stack = runtime.m_stack;
+
+            fmt::print(stderr, "{:>8}  {:<20}{:<10}", runtime.m_program_counter, op_code_name(code.op_code),
+                operand_text(code));
+
+            if (stack.empty())
+            {
+                fmt::print(stderr, "  # depth 0\n");
+            }
+            else
+            {
+                fmt::print(stderr, "  # depth {}, top {}\n", stack.size(), stack.top());
+            }
+        }
+
+        inline void on_finish() {}
+    };
+
+    int ShrekRuntime::execute()
+    {
+        // Hooks are for debuggers, so they take precedence over the tracing and counting options.
+        if (m_hooks)
+        {
+            return dispatch_loop<StepHooks>();
+        }
+
+        if (m_options.trace)
+        {
+            return dispatch_loop<Tracing>();
+        }
+
+        if (!m_options.profile_file.empty())
+        {
+            m_profile.assign(m_code.size(), 0);
+            return dispatch_loop<Profiling>();
+        }
+
+        if (m_options.count_steps)
+        {
+            return dispatch_loop<StepCounting>();
+        }
+
+        if (m_jit)
+        {
+            return run_compiled();
+        }
+
+        return dispatch_loop<NoHooks>();
+    }
+
+    template <typename Policy>
+    int ShrekRuntime::dispatch_loop()
+    {
+        if (m_options.dispatch == DispatchMode::threaded)
+        {
+            return threaded_loop<Policy>();
+        }
+
+        // Hooks and tracing look at m_stack, which does not hold the values tos_loop caches.
+        if (m_options.dispatch == DispatchMode::top_of_stack && std::is_same_v<Policy, NoHooks>)
+        {
+            return tos_loop();
+        }
+
+        return main_loop<Policy>();
+    }
+
+    template <typename Policy>
+    int ShrekRuntime::main_loop()
+    {
+        Policy policy(*this);
+
+        while (m_program_counter < m_code.size())
+        {
+            // The halt that linking appends is not an instruction of the program, so it is not counted, traced or
+            // profiled, and debuggers do not stop on it.
+            if (m_code[m_program_counter].op_code != OpCode::halt)
+            {
+                policy.on_step();
+            }
+
+            // Linked code always ends with halt and every jump targets an instruction, so the loop condition is the
+            // only bounds check needed.
+            execute_instruction(m_code[m_program_counter]);
+        }
+
+        policy.on_finish();
+
+        return exit_code();
+    }
+
+    void ShrekRuntime::execute_instruction(const ByteCode& code)
+    {
+        switch (code.op_code)
+        {
+        case OpCode::label:
+        case OpCode::no_op:
+            step_program();
+            break;
+        case OpCode::push0:
+            op_push0();
+            break;
+        case OpCode::pop:
+            op_pop();
+            break;
+        case OpCode::bump:
+            op_bump();
+            break;
+        case OpCode::func:
+            op_func();
+            break;
+        case OpCode::jump:
+            op_jump(code);
+            break;
+        case OpCode::jmp:
+            op_jmp(code);
+            break;
+        case OpCode::jz:
+            op_jz(code);
+            break;
+        case OpCode::jneg:
+            op_jneg(code);
+            break;
+        case OpCode::push_const:
+            op_push_const(code);
+            break;
+        case OpCode::add_const:
+            op_add_const(code);
+            break;
+        case OpCode::call_direct:
+            op_call_direct(code);
+            break;
+        case OpCode::call_fast:
+            op_call_fast(code);
+            break;
+        case OpCode::input:
+            op_input();
+            break;
+        case OpCode::output:
+            op_output();
+            break;
+        case OpCode::add:
+            op_add();
+            break;
+        case OpCode::subtract:
+            op_subtract();
+            break;
+        case OpCode::multiply:
+            op_multiply();
+            break;
+        case OpCode::divide:
+            op_divide();
+            break;
+        case OpCode::mod:
+            op_mod();
+            break;
+        case OpCode::double_:
+            op_double();
+            break;
+        case OpCode::negate:
+            op_negate();
+            break;
+        case OpCode::clone:
+            op_clone();
+            break;
+        case OpCode::pop_unchecked:
+            op_pop_unchecked();
+            break;
+        case OpCode::bump_unchecked:
+            op_bump_unchecked();
+            break;
+        case OpCode::add_const_unchecked:
+            op_add_const_unchecked(code);
+            break;
+        case OpCode::jz_unchecked:
+            op_jz_unchecked(code);
+            break;
+        case OpCode::jneg_unchecked:
+            op_jneg_unchecked(code);
+            break;
+        case OpCode::add_unchecked:
+            op_add_unchecked();
+            break;
+        case OpCode::subtract_unchecked:
+            op_subtract_unchecked();
+            break;
+        case OpCode::multiply_unchecked:
+            op_multiply_unchecked();
+            break;
+        case OpCode::reg_set:
+            op_reg_set(code);
+            break;
+        case OpCode::reg_move:
+            op_reg_move(code);
+            break;
+        case OpCode::reg_add:
+            op_reg_add(code);
+            break;
+        case OpCode::reg_add_imm:
+            op_reg_add_imm(code);
+            break;
+        case OpCode::reg_sub:
+            op_reg_sub(code);
+            break;
+        case OpCode::reg_rsub_imm:
+            op_reg_rsub_imm(code);
+            break;
+        case OpCode::reg_mul:
+            op_reg_mul(code);
+            break;
+        case OpCode::reg_mul_imm:
+            op_reg_mul_imm(code);
+            break;
+        case OpCode::reg_jz:
+            op_reg_jz(code);
+            break;
+        case OpCode::reg_jneg:
+            op_reg_jneg(code);
+            break;
+        case OpCode::reg_sync:
+            op_reg_sync(code);
+            break;
+        case OpCode::superinstruction:
+            op_superinstruction(code);
+            break;
+        case OpCode::halt:
+            op_halt();
+            break;
+        default:
+            throw RuntimeError("Invalid operation");
+        }
+    }
+
+    template <typename Policy>
+    int ShrekRuntime::threaded_loop()
+    {
+#ifdef SHREK_THREADED_DISPATCH
+        Policy policy(*this);
+
+        // One indirect jump at the end of every handler, so the branch predictor sees each op code's successors
+        // separately. Must list a label for every op code, in op code order.
+        static const void* const dispatch_table[] =
+        {
+            &&l_no_op,
+            &&l_label,
+            &&l_push0,
+            &&l_pop,
+            &&l_bump,
+            &&l_func,
+            &&l_jump,
+            &&l_jmp,
+            &&l_jz,
+            &&l_jneg,
+            &&l_push_const,
+            &&l_add_const,
+            &&l_call_direct,
+            &&l_call_fast,
+            &&l_input,
+            &&l_output,
+            &&l_add,
+            &&l_subtract,
+            &&l_multiply,
+            &&l_divide,
+            &&l_mod,
+            &&l_double,
+            &&l_negate,
+            &&l_clone,
+            &&l_pop_unchecked,
+            &&l_bump_unchecked,
+            &&l_add_const_unchecked,
+            &&l_jz_unchecked,
+            &&l_jneg_unchecked,
+            &&l_add_unchecked,
+            &&l_subtract_unchecked,
+            &&l_multiply_unchecked,
+            &&l_reg_set,
+            &&l_reg_move,
+            &&l_reg_add,
+            &&l_reg_add_imm,
+            &&l_reg_sub,
+            &&l_reg_rsub_imm,
+            &&l_reg_mul,
+            &&l_reg_mul_imm,
+            &&l_reg_jz,
+            &&l_reg_jneg,
+            &&l_reg_sync,
+            &&l_superinstruction,
+            &&l_halt
+        };
+
+        static_assert(sizeof(dispatch_table) / sizeof(dispatch_table[0]) == op_code_count,
+            "threaded dispatch table does not match OpCode");
+
+#define SHREK_DISPATCH()                                                                \
+        do                                                                              \
+        {                                                                               \
+            if (m_code[m_program_counter].op_code != OpCode::halt)                      \
+            {                                                                           \
+                policy.on_step();                                                       \
+            }                                                                           \
+            goto *dispatch_table[(std::size_t)m_code[m_program_counter].op_code];       \
+        } while (false)
+
+        SHREK_DISPATCH();
+
+    l_no_op:
+    l_label:
+        step_program();
+        SHREK_DISPATCH();
+
+    l_push0:
+        op_push0();
+        SHREK_DISPATCH();
+
+    l_pop:
+        op_pop();
+        SHREK_DISPATCH();
+
+    l_bump:
+        op_bump();
+        SHREK_DISPATCH();
+
+    l_func:
+        op_func();
+        SHREK_DISPATCH();
+
+    l_jump:
+        op_jump(m_code[m_program_counter]);
+        SHREK_DISPATCH();
+
+    l_jmp:
+        op_jmp(m_code[m_program_counter]);
+        SHREK_DISPATCH();
+
+    l_jz:
+        op_jz(m_code[m_program_counter]);
+        SHREK_DISPATCH();
+
+    l_jneg:
+        op_jneg(m_code[m_program_counter]);
+        SHREK_DISPATCH();
+
+    l_push_const:
+        op_push_const(m_code[m_program_counter]);
+        SHREK_DISPATCH();
+
+    l_add_const:
+        op_add_const(m_code[m_program_counter]);
+        SHREK_DISPATCH();
+
+    l_call_direct:
+        op_call_direct(m_code[m_program_counter]);
+        SHREK_DISPATCH();
+
+    l_call_fast:
+        op_call_fast(m_code[m_program_counter]);
+        SHREK_DISPATCH();
+
+    l_input:
+        op_input();
+        SHREK_DISPATCH();
+
+    l_output:
+        op_output();
+        SHREK_DISPATCH();
+
+    l_add:
+        op_add();
+        SHREK_DISPATCH();
+
+    l_subtract:
+        op_subtract();
+        SHREK_DISPATCH();
+
+    l_multiply:
+        op_multiply();
+        SHREK_DISPATCH();
+
+    l_divide:
+        op_divide();
+        SHREK_DISPATCH();
+
+    l_mod:
+        op_mod();
+        SHREK_DISPATCH();
+
+    l_double:
+        op_double();
+        SHREK_DISPATCH();
+
+    l_negate:
+        op_negate();
+        SHREK_DISPATCH();
+
+    l_clone:
+        op_clone();
+        SHREK_DISPATCH();
+
+    l_pop_unchecked:
+        op_pop_unchecked();
+        SHREK_DISPATCH();
+
+    l_bump_unchecked:
+        op_bump_unchecked();
+        SHREK_DISPATCH();
+
+    l_add_const_unchecked:
+        op_add_const_unchecked(m_code[m_program_counter]);
+        SHREK_DISPATCH();
+
+    l_jz_unchecked:
+        op_jz_unchecked(m_code[m_program_counter]);
+        SHREK_DISPATCH();
+
+    l_jneg_unchecked:
+        op_jneg_unchecked(m_code[m_program_counter]);
+        SHREK_DISPATCH();
+
+    l_add_unchecked:
+        op_add_unchecked();
+        SHREK_DISPATCH();
+
+    l_subtract_unchecked:
+        op_subtract_unchecked();
+        SHREK_DISPATCH();
+
+    l_multiply_unchecked:
+        op_multiply_unchecked();
+        SHREK_DISPATCH();
+
+    l_reg_set:
+        op_reg_set(m_code[m_program_counter]);
+        SHREK_DISPATCH();
+
+    l_reg_move:
+        op_reg_move(m_code[m_program_counter]);
+        SHREK_DISPATCH();
+
+    l_reg_add:
+        op_reg_add(m_code[m_program_counter]);
+        SHREK_DISPATCH();
+
+    l_reg_add_imm:
+        op_reg_add_imm(m_code[m_program_counter]);
+        SHREK_DISPATCH();
+
+    l_reg_sub:
+        op_reg_sub(m_code[m_program_counter]);
+        SHREK_DISPATCH();
+
+    l_reg_rsub_imm:
+        op_reg_rsub_imm(m_code[m_program_counter]);
+        SHREK_DISPATCH();
+
+    l_reg_mul:
+        op_reg_mul(m_code[m_program_counter]);
+        SHREK_DISPATCH();
+
+    l_reg_mul_imm:
+        op_reg_mul_imm(m_code[m_program_counter]);
+        SHREK_DISPATCH();
+
+    l_reg_jz:
+        op_reg_jz(m_code[m_program_counter]);
+        SHREK_DISPATCH();
+
+    l_reg_jneg:
+        op_reg_jneg(m_code[m_program_counter]);
+        SHREK_DISPATCH();
+
+    l_reg_sync:
+        op_reg_sync(m_code[m_program_counter]);
+        SHREK_DISPATCH();
+
+    l_superinstruction:
+        op_superinstruction(m_code[m_program_counter]);
+        SHREK_DISPATCH();
+
+    l_halt:
+        op_halt();
+        policy.on_finish();
+        return exit_code();
+
+#undef SHREK_DISPATCH
+#else
+        return main_loop<Policy>();
+#endif
+    }
+
+    // Case label for an op code run with the given number of values cached by tos_loop.
+    static constexpr int tos_case(OpCode op_code, int cached)
+    {
+        return (int)op_code * 3 + cached;
+    }
+
+    int ShrekRuntime::tos_loop()
+    {
+        // The top of the stack is t0 when one or two values are cached, with t1 below it when two are. Everything
+        // below the cached values is in m_stack.
+        int t0 = 0;
+        int t1 = 0;
+        int cached = 0;
+
+        // Cached values count towards --max-stack, so a push that would pass it goes through the checked path.
+        auto depth_limit = m_stack.max_depth() == ValueStack::unlimited_depth
+            ? std::numeric_limits<std::size_t>::max() : m_stack.max_depth();
+
+        // The program counter is a local as well, and only written back for the plain handlers.
+        auto pc = m_program_counter;
+        const auto* program = m_code.data();
+
+        while (true)
+        {
+            const auto& code = program[pc];
+
+            switch (tos_case(code.op_code, cached))
+            {
+            case tos_case(OpCode::label, 0):
+            case tos_case(OpCode::label, 1):
+            case tos_case(OpCode::label, 2):
+            case tos_case(OpCode::no_op, 0):
+            case tos_case(OpCode::no_op, 1):
+            case tos_case(OpCode::no_op, 2):
+                ++pc;
+                continue;
+
+            case tos_case(OpCode::jmp, 0):
+            case tos_case(OpCode::jmp, 1):
+            case tos_case(OpCode::jmp, 2):
+                pc = (std::size_t)code.a;
+                continue;
+
+            // push0 always has 0 in a, so it shares the push_const cases.
+            case tos_case(OpCode::push0, 0):
+            case tos_case(OpCode::push_const, 0):
+                if (m_stack.size() >= depth_limit)
+                {
+                    break;
+                }
+
+                t0 = code.a;
+                cached = 1;
+                ++pc;
+                continue;
+
+            case tos_case(OpCode::push0, 1):
+            case tos_case(OpCode::push_const, 1):
+                if (m_stack.size() + 1 >= depth_limit)
+                {
+                    break;
+                }
+
+                t1 = t0;
+                t0 = code.a;
+                cached = 2;
+                ++pc;
+                continue;
+
+            case tos_case(OpCode::push0, 2):
+            case tos_case(OpCode::push_const, 2):
+                if (m_stack.size() + 2 >= depth_limit)
+                {
+                    break;
+                }
+
+                m_stack.push(t1);
+                t1 = t0;
+                t0 = code.a;
+                ++pc;
+                continue;
+
+            case tos_case(OpCode::pop, 1):
+            case tos_case(OpCode::pop_unchecked, 1):
+                cached = 0;
+                ++pc;
+                continue;
+
+            case tos_case(OpCode::pop, 2):
+            case tos_case(OpCode::pop_unchecked, 2):
+                t0 = t1;
+                cached = 1;
+                ++pc;
+                continue;
+
+            case tos_case(OpCode::bump, 1):
+            case tos_case(OpCode::bump, 2):
+            case tos_case(OpCode::bump_unchecked, 1):
+            case tos_case(OpCode::bump_unchecked, 2):
+                ++t0;
+                ++pc;
+                continue;
+
+            case tos_case(OpCode::add_const, 1):
+            case tos_case(OpCode::add_const, 2):
+            case tos_case(OpCode::add_const_unchecked, 1):
+            case tos_case(OpCode::add_const_unchecked, 2):
+                t0 += code.a;
+                ++pc;
+                continue;
+
+            case tos_case(OpCode::jz, 1):
+            case tos_case(OpCode::jz, 2):
+            case tos_case(OpCode::jz_unchecked, 1):
+            case tos_case(OpCode::jz_unchecked, 2):
+                pc = t0 == 0 ? (std::size_t)code.a : pc + 1;
+                continue;
+
+            case tos_case(OpCode::jneg, 1):
+            case tos_case(OpCode::jneg, 2):
+            case tos_case(OpCode::jneg_unchecked, 1):
+            case tos_case(OpCode::jneg_unchecked, 2):
+                pc = t0 < 0 ? (std::size_t)code.a : pc + 1;
+                continue;
+
+            case tos_case(OpCode::add, 2):
+            case tos_case(OpCode::add_unchecked, 2):
+                t0 = t1 + t0;
+                cached = 1;
+                ++pc;
+                continue;
+
+            case tos_case(OpCode::subtract, 2):
+            case tos_case(OpCode::subtract_unchecked, 2):
+                t0 = t1 - t0;
+                cached = 1;
+                ++pc;
+                continue;
+
+            case tos_case(OpCode::multiply, 2):
+            case tos_case(OpCode::multiply_unchecked, 2):
+                t0 = t1 * t0;
+                cached = 1;
+                ++pc;
+                continue;
+
+            case tos_case(OpCode::add, 1):
+            case tos_case(OpCode::subtract, 1):
+            case tos_case(OpCode::multiply, 1):
+            case tos_case(OpCode::add_unchecked, 1):
+            case tos_case(OpCode::subtract_unchecked, 1):
+            case tos_case(OpCode::multiply_unchecked, 1):
+                // Cache the value below, then run the instruction again with both operands cached.
+                if (m_stack.empty())
+                {
+                    break;
+                }
+
+                t1 = m_stack.top();
+                m_stack.pop();
+                cached = 2;
+                continue;
+
+            case tos_case(OpCode::double_, 1):
+            case tos_case(OpCode::double_, 2):
+                t0 = t0 * 2;
+                ++pc;
+                continue;
+
+            case tos_case(OpCode::negate, 1):
+            case tos_case(OpCode::negate, 2):
+                t0 = -t0;
+                ++pc;
+                continue;
+
+            case tos_case(OpCode::clone, 1):
+                if (m_stack.size() + 1 >= depth_limit)
+                {
+                    break;
+                }
+
+                t1 = t0;
+                cached = 2;
+                ++pc;
+                continue;
+
+            case tos_case(OpCode::clone, 2):
+                if (m_stack.size() + 2 >= depth_limit)
+                {
+                    break;
+                }
+
+                m_stack.push(t1);
+                t1 = t0;
+                ++pc;
+                continue;
+
+            case tos_case(OpCode::pop, 0):
+            case tos_case(OpCode::pop_unchecked, 0):
+            case tos_case(OpCode::bump, 0):
+            case tos_case(OpCode::bump_unchecked, 0):
+            case tos_case(OpCode::add_const, 0):
+            case tos_case(OpCode::add_const_unchecked, 0):
+            case tos_case(OpCode::jz, 0):
+            case tos_case(OpCode::jz_unchecked, 0):
+            case tos_case(OpCode::jneg, 0):
+            case tos_case(OpCode::jneg_unchecked, 0):
+            case tos_case(OpCode::add, 0):
+            case tos_case(OpCode::add_unchecked, 0):
+            case tos_case(OpCode::subtract, 0):
+            case tos_case(OpCode::subtract_unchecked, 0):
+            case tos_case(OpCode::multiply, 0):
+            case tos_case(OpCode::multiply_unchecked, 0):
+            case tos_case(OpCode::double_, 0):
+            case tos_case(OpCode::negate, 0):
+            case tos_case(OpCode::clone, 0):
+                // Cache the top value, then run the instruction again.
+                if (m_stack.empty())
+                {
+                    break;
+                }
+
+                t0 = m_stack.top();
+                m_stack.pop();
+                cached = 1;
+                continue;
+
+            default:
+                break;
+            }
+
+            // Everything else, and every case that can fail, runs the plain handler against m_stack with nothing cached.
+            // That covers function calls, which see the whole stack through the C API, and halt.
+            if (cached == 2)
+            {
+                m_stack.push(t1);
+            }
+
+            if (cached >= 1)
+            {
+                m_stack.push(t0);
+            }
+
+            cached = 0;
+
+            m_program_counter = pc;
+            execute_instruction(code);
+            pc = m_program_counter;
+
+            if (pc >= m_code.size())
+            {
+                return exit_code();
+            }
+        }
+    }
+
+    int ShrekRuntime::exit_code() const
+    {
+        int exit_code = 0;
+        if (!m_stack.empty())
+        {
+            exit_code = m_stack.top();
+        }
+
+        return exit_code;
+    }
+
+    void ShrekRuntime::step_program()
+    {
+        ++m_program_counter;
+    }
+
+    void ShrekRuntime::load_superinstructions()
+    {
+        SuperinstructionProfile profile;
+        if (!read_superinstruction_profile(m_options.superinstruction_file, profile))
+        {
+            throw RuntimeError("Failed to read superinstruction profile");
+        }
+
+        m_superinstructions = std::move(profile.superinstructions);
+        auto sites = apply_superinstructions(m_code, m_superinstructions);
+
+        if (m_options.print_stats)
+        {
+            fmt::print(stderr, "superinstructions: {} sequences at {} sites\n", m_superinstructions.size(), sites);
+        }
+    }
+
+    void ShrekRuntime::write_profile()
+    {
+        if (m_profile.empty())
+        {
+            return;
+        }
+
+        auto profile = select_superinstructions(m_code, m_profile, m_options.superinstruction_count);
+        m_profile.clear();
+
+        if (!write_superinstruction_profile(m_options.profile_file, profile))
+        {
+            fmt::print(stderr, "Failed to write superinstruction profile\n");
+            return;
+        }
+
+        auto percent = profile.dispatches == 0 ? 0.0 : 100.0 * (double)profile.saved / (double)profile.dispatches;
+        fmt::print(stderr, "profile: {} superinstructions remove {} of {} dispatches ({:.1f}%)\n",
+            profile.superinstructions.size(), profile.saved, profile.dispatches, percent);
+    }
+
+    void ShrekRuntime::compile_program()
+    {
+        JitResult result;
+        m_jit = compile_jit(m_code, result);
+
+        if (m_options.print_stats && m_jit)
+        {
+            fmt::print(stderr, "jit: {} instructions compiled, {} run by the interpreter, {} bytes of machine code\n",
+                result.compiled, result.interpreted, result.code_size);
+        }
+        else if (m_options.print_stats)
+        {
+            fmt::print(stderr, "jit: not used, {}\n",
+                jit_supported() ? "no executable memory" : "not supported on this platform");
+        }
+    }
+
+    int ShrekRuntime::run_compiled()
+    {
+        JitContext context;
+        context.begin = m_stack.data();
+        context.top = context.begin + m_stack.size();
+        context.end = context.begin + m_stack.capacity();
+        context.run_instruction = &ShrekRuntime::run_instruction_for_jit;
+        context.runtime = this;
+
+        auto ok = m_jit->run(context, m_program_counter);
+        m_stack.set_size((std::size_t)(context.top - context.begin));
+
+        // Exceptions cannot pass through compiled code, so errors come back as a code and are thrown from here.
+        if (!ok)
+        {
+            auto exception = m_jit_exception;
+            m_jit_exception = nullptr;
+            std::rethrow_exception(exception);
+        }
+
+        m_program_counter = m_code.size();
+        return exit_code();
+    }
+
+    std::size_t ShrekRuntime::run_instruction_for_jit(JitContext* context, std::size_t index)
+    {
+        auto& runtime = *static_cast<ShrekRuntime*>(context->runtime);
+        runtime.m_stack.set_size((std::size_t)(context->top - context->begin));
+        runtime.m_program_counter = index;
+
+        auto next = jit_error;
+        try
+        {
+            runtime.execute_instruction(runtime.m_code[index]);
+            next = runtime.m_program_counter;
+        }
+        catch (...)
+        {
+            runtime.m_jit_exception = std::current_exception();
+        }
+
+        // The stack may have grown and moved.
+        context->begin = runtime.m_stack.data();
+        context->top = context->begin + runtime.m_stack.size();
+        context->end = context->begin + runtime.m_stack.capacity();
+        return next;
+    }
+
+    void ShrekRuntime::op_push0()
+    {
+        m_stack.push(0);
+        step_program();
+    }
+
+    void ShrekRuntime::op_pop()
+    {
+        if (m_stack.empty())
+        {
+            throw RuntimeError("Stack is empty");
+        }
+
+        m_stack.pop();
+
+        step_program();
+    }
+
+    void ShrekRuntime::op_bump()
+    {
+        if (m_stack.empty())
+        {
+            throw RuntimeError("Stack is empty");
+        }
+
+        ++m_stack.top();
+
+        step_program();
+    }
+
+    void ShrekRuntime::op_func()
+    {
+        if (m_stack.empty())
+        {
+            throw RuntimeError("Stack is empty");
+        }
+
+        auto func_num = m_stack.top();
+        m_stack.pop();
+
+        auto function = m_func_table.find(func_num);
+        if (function && function->func && func_num >= 0 && func_num < intrinsic_count
+            && function->func == builtins::builtin_func(func_num))
+        {
+            // Function numbers only known at run time still skip the C API for unmodified built-ins. Fast functions
+            // have no func, which builtin_func also returns for numbers that are not built-ins, so both are checked.
+            op_intrinsic(intrinsic_op_code(func_num));
+            return;
+        }
+
+        if (!function)
+        {
+            throw RuntimeError(fmt::format("Function number {} not registered", func_num));
+        }
+
+        ++m_dynamic_calls;
+        if (function->fast_func)
+        {
+            call_fast_function(func_num, *function);
+        }
+        else
+        {
+            call_function(func_num, function->func);
+        }
+
+        step_program();
+    }
+
+    void ShrekRuntime::op_call_direct(const ByteCode& code)
+    {
+        ++m_bound_calls;
+        call_function(code.a, code.function->func);
+
+        step_program();
+    }
+
+    void ShrekRuntime::op_call_fast(const ByteCode& code)
+    {
+        ++m_bound_calls;
+        call_fast_function(code.a, *code.function);
+
+        step_program();
+    }
+
+    void ShrekRuntime::call_function(int func_num, ShrekFunc func)
+    {
+        m_func_exception.clear();
+
+        int rc = func(m_owning_handle);
+        if (rc != SHREK_OK)
+        {
+            // Built-ins have always failed with the generic text, whatever they pass to shrek_set_except, and the
+            // intrinsics fail the same way.
+            if (m_func_exception.empty() || builtins::is_builtin_func(func))
+            {
+                m_func_exception = missing_func_exception;
+            }
+
+            throw RuntimeError(fmt::format("Error running function {}: {}", func_num, m_func_exception));
+        }
+    }
+
+    void ShrekRuntime::call_fast_function(int func_num, const FunctionEntry& function)
+    {
+        auto arg_count = (std::size_t)function.arg_count;
+        auto result_count = (std::size_t)function.result_count;
+
+        if (m_stack.size() < arg_count)
+        {
+            throw RuntimeError(fmt::format("Error running function {}: requires {} values on the stack", func_num,
+                arg_count));
+        }
+
+        // Arguments are passed in place, bottom to top, so the function must not change the stack itself.
+        m_func_exception.clear();
+
+        int rc = function.fast_func(m_owning_handle, m_stack.data() + m_stack.size() - arg_count, m_fast_results.data());
+        if (rc != SHREK_OK)
+        {
+            if (m_func_exception.empty())
+            {
+                m_func_exception = missing_func_exception;
+            }
+
+            throw RuntimeError(fmt::format("Error running function {}: {}", func_num, m_func_exception));
+        }
+
+        m_stack.pop_n(arg_count);
+        m_stack.push_n(m_fast_results.data(), result_count);
+    }
+
+    void ShrekRuntime::rebind_calls()
+    {
+        for (auto& code : m_code)
+        {
+            if (code.op_code == OpCode::call_direct || code.op_code == OpCode::call_fast)
+            {
+                code.function = m_func_table.find(code.a);
+            }
+        }
+    }
+
+    void ShrekRuntime::op_jump(const ByteCode& code)
+    {
+        constexpr auto jump = 0;
+        constexpr auto jump_0 = 1;
+        constexpr auto jump_neg = 2;
+
+        if (m_stack.empty())
+        {
+            throw RuntimeError("Stack is empty");
+        }
+
+        // Top of m_stack indicates jump type.
+        auto s0 = m_stack.top();
+        m_stack.pop();
+
+        if (s0 == jump)
+        {
+            m_program_counter = (std::size_t)code.a;
+        }
+        else if(s0 == jump_0)
+        {
+            if (m_stack.empty())
+            {
+                throw RuntimeError("jump0 requires value on m_stack after jump type");
+            }
+
+            auto s1 = m_stack.top();
+            if (s1 == 0)
+            {
+                m_program_counter = (std::size_t)code.a;
+            }
+            else
+            {
+                step_program();
+            }
+        }
+        else if (s0 == jump_neg)
+        {
+            if (m_stack.empty())
+            {
+                throw RuntimeError("jump_neg requires value on m_stack after jump type");
+            }
+
+            auto s1 = m_stack.top();
+            if (s1 < 0)
+            {
+                m_program_counter = (std::size_t)code.a;
+            }
+            else
+            {
+                step_program();
+            }
+        }
+        else
+        {
+            throw RuntimeError("Invalid jump type");
+        }
+    }
+
+    void ShrekRuntime::op_jmp(const ByteCode& code)
+    {
+        m_program_counter = (std::size_t)code.a;
+    }
+
+    void ShrekRuntime::op_jz(const ByteCode& code)
+    {
+        if (m_stack.empty())
+        {
+            throw RuntimeError("jump0 requires value on m_stack after jump type");
+        }
+
+        if (m_stack.top() == 0)
+        {
+            m_program_counter = (std::size_t)code.a;
+        }
+        else
+        {
+            step_program();
+        }
+    }
+
+    void ShrekRuntime::op_jneg(const ByteCode& code)
+    {
+        if (m_stack.empty())
+        {
+            throw RuntimeError("jump_neg requires value on m_stack after jump type");
+        }
+
+        if (m_stack.top() < 0)
+        {
+            m_program_counter = (std::size_t)code.a;
+        }
+        else
+        {
+            step_program();
+        }
+    }
+
+    void ShrekRuntime::op_push_const(const ByteCode& code)
+    {
+        m_stack.push(code.a);
+        step_program();
+    }
+
+    void ShrekRuntime::op_add_const(const ByteCode& code)
+    {
+        if (m_stack.empty())
+        {
+            throw RuntimeError("Stack is empty");
+        }
+
+        m_stack.top() += code.a;
+        step_program();
+    }
+
+    void ShrekRuntime::op_halt()
+    {
+        m_program_counter = m_code.size();
+    }
+
+    // Same error as a built-in failing through the C API, so intrinsics fail the same way.
+    [[noreturn]] static void throw_builtin_error(OpCode op_code)
+    {
+        throw RuntimeError(fmt::format("Error running function {}: {}", intrinsic_func_number(op_code),
+            missing_func_exception));
+    }
+
+    void ShrekRuntime::op_intrinsic(OpCode op_code)
+    {
+        switch (op_code)
+        {
+        case OpCode::input:
+            op_input();
+            break;
+        case OpCode::output:
+            op_output();
+            break;
+        case OpCode::add:
+            op_add();
+            break;
+        case OpCode::subtract:
+            op_subtract();
+            break;
+        case OpCode::multiply:
+            op_multiply();
+            break;
+        case OpCode::divide:
+            op_divide();
+            break;
+        case OpCode::mod:
+            op_mod();
+            break;
+        case OpCode::double_:
+            op_double();
+            break;
+        case OpCode::negate:
+            op_negate();
+            break;
+        case OpCode::clone:
+            op_clone();
+            break;
+        default:
+            throw RuntimeError("Invalid operation");
+        }
+    }
+
+    void ShrekRuntime::op_input()
+    {
+        std::string line;
+
+        try
+        {
+            std::getline(std::cin, line);
+        }
+        catch (...)
+        {
+            throw_builtin_error(OpCode::input);
+        }
+
+        if (line.size() > (std::size_t)std::numeric_limits<int>::max())
+        {
+            throw_builtin_error(OpCode::input);
+        }
+
+        // Make room for the line and its length first, so running out of stack fails before anything is pushed, the
+        // same as shrek_push_n.
+        try
+        {
+            m_stack.reserve(line.size() + 1);
+        }
+        catch (...)
+        {
+            throw_builtin_error(OpCode::input);
+        }
+
+        std::size_t i = line.size();
+        while (i-- > 0)
+        {
+            m_stack.push(line[i]);
+        }
+
+        m_stack.push((int)line.size());
+
+        step_program();
+    }
+
+    void ShrekRuntime::op_output()
+    {
+        if (m_stack.empty())
+        {
+            throw_builtin_error(OpCode::output);
+        }
+
+        try
+        {
+            fmt::print("{:#x}\n", m_stack.top());
+            std::cout.flush();
+        }
+        catch (...)
+        {
+            throw_builtin_error(OpCode::output);
+        }
+
+        step_program();
+    }
+
+    void ShrekRuntime::op_add()
+    {
+        if (m_stack.size() < 2)
+        {
+            throw_builtin_error(OpCode::add);
+        }
+
+        auto v0 = m_stack.top();
+        m_stack.pop();
+
+        m_stack.top() = m_stack.top() + v0;
+        step_program();
+    }
+
+    void ShrekRuntime::op_subtract()
+    {
+        if (m_stack.size() < 2)
+        {
+            throw_builtin_error(OpCode::subtract);
+        }
+
+        auto v0 = m_stack.top();
+        m_stack.pop();
+
+        m_stack.top() = m_stack.top() - v0;
+        step_program();
+    }
+
+    void ShrekRuntime::op_multiply()
+    {
+        if (m_stack.size() < 2)
+        {
+            throw_builtin_error(OpCode::multiply);
+        }
+
+        auto v0 = m_stack.top();
+        m_stack.pop();
+
+        m_stack.top() = m_stack.top() * v0;
+        step_program();
+    }
+
+    void ShrekRuntime::op_divide()
+    {
+        if (m_stack.size() < 2)
+        {
+            throw_builtin_error(OpCode::divide);
+        }
+
+        auto v0 = m_stack.top();
+        m_stack.pop();
+
+        m_stack.top() = m_stack.top() / v0;
+        step_program();
+    }
+
+    void ShrekRuntime::op_mod()
+    {
+        if (m_stack.size() < 2)
+        {
+            throw_builtin_error(OpCode::mod);
+        }
+
+        auto v0 = m_stack.top();
+        m_stack.pop();
+
+        m_stack.top() = m_stack.top() % v0;
+        step_program();
+    }
+
+    void ShrekRuntime::op_double()
+    {
+        if (m_stack.empty())
+        {
+            throw_builtin_error(OpCode::double_);
+        }
+
+        m_stack.top() = m_stack.top() * 2;
+        step_program();
+    }
+
+    void ShrekRuntime::op_negate()
+    {
+        if (m_stack.empty())
+        {
+            throw_builtin_error(OpCode::negate);
+        }
+
+        m_stack.top() = -m_stack.top();
+        step_program();
+    }
+
+    void ShrekRuntime::op_clone()
+    {
+        if (m_stack.empty())
+        {
+            throw_builtin_error(OpCode::clone);
+        }
+
+        try
+        {
+            m_stack.push(m_stack.top());
+        }
+        catch (const RuntimeError&)
+        {
+            throw_builtin_error(OpCode::clone);
+        }
+
+        step_program();
+    }
+
+    void ShrekRuntime::op_pop_unchecked()
+    {
+        m_stack.pop();
+        step_program();
+    }
+
+    void ShrekRuntime::op_bump_unchecked()
+    {
+        ++m_stack.top();
+        step_program();
+    }
+
+    void ShrekRuntime::op_add_const_unchecked(const ByteCode& code)
+    {
+        m_stack.top() += code.a;
+        step_program();
+    }
+
+    void ShrekRuntime::op_jz_unchecked(const ByteCode& code)
+    {
+        if (m_stack.top() == 0)
+        {
+            m_program_counter = (std::size_t)code.a;
+        }
+        else
+        {
+            step_program();
+        }
+    }
+
+    void ShrekRuntime::op_jneg_unchecked(const ByteCode& code)
+    {
+        if (m_stack.top() < 0)
+        {
+            m_program_counter = (std::size_t)code.a;
+        }
+        else
+        {
+            step_program();
+        }
+    }
+
+    void ShrekRuntime::op_add_unchecked()
+    {
+        auto v0 = m_stack.top();
+        m_stack.pop();
+
+        m_stack.top() = m_stack.top() + v0;
+        step_program();
+    }
+
+    void ShrekRuntime::op_subtract_unchecked()
+    {
+        auto v0 = m_stack.top();
+        m_stack.pop();
+
+        m_stack.top() = m_stack.top() - v0;
+        step_program();
+    }
+
+    void ShrekRuntime::op_multiply_unchecked()
+    {
+        auto v0 = m_stack.top();
+        m_stack.pop();
+
+        m_stack.top() = m_stack.top() * v0;
+        step_program();
+    }
+
+    void ShrekRuntime::op_reg_set(const ByteCode& code)
+    {
+        m_stack.data()[code.b] = code.a;
+        step_program();
+    }
+
+    void ShrekRuntime::op_reg_move(const ByteCode& code)
+    {
+        auto* registers = m_stack.data();
+        registers[code.b] = registers[code.c];
+        step_program();
+    }
+
+    void ShrekRuntime::op_reg_add(const ByteCode& code)
+    {
+        auto* registers = m_stack.data();
+        registers[code.b] = registers[code.c] + registers[code.a];
+        step_program();
+    }
+
+    void ShrekRuntime::op_reg_add_imm(const ByteCode& code)
+    {
+        auto* registers = m_stack.data();
+        registers[code.b] = registers[code.c] + code.a;
+        step_program();
+    }
+
+    void ShrekRuntime::op_reg_sub(const ByteCode& code)
+    {
+        auto* registers = m_stack.data();
+        registers[code.b] = registers[code.c] - registers[code.a];
+        step_program();
+    }
+
+    void ShrekRuntime::op_reg_rsub_imm(const ByteCode& code)
+    {
+        auto* registers = m_stack.data();
+        registers[code.b] = code.a - registers[code.c];
+        step_program();
+    }
+
+    void ShrekRuntime::op_reg_mul(const ByteCode& code)
+    {
+        auto* registers = m_stack.data();
+        registers[code.b] = registers[code.c] * registers[code.a];
+        step_program();
+    }
+
+    void ShrekRuntime::op_reg_mul_imm(const ByteCode& code)
+    {
+        auto* registers = m_stack.data();
+        registers[code.b] = registers[code.c] * code.a;
+        step_program();
+    }
+
+    void ShrekRuntime::op_reg_jz(const ByteCode& code)
+    {
+        if (m_stack.data()[code.b] == 0)
+        {
+            m_program_counter = (std::size_t)code.a;
+        }
+        else
+        {
+            step_program();
+        }
+    }
+
+    void ShrekRuntime::op_reg_jneg(const ByteCode& code)
+    {
+        if (m_stack.data()[code.b] < 0)
+        {
+            m_program_counter = (std::size_t)code.a;
+        }
+        else
+        {
+            step_program();
+        }
+    }
+
+    void ShrekRuntime::op_reg_sync(const ByteCode& code)
+    {
+        m_stack.set_size((std::size_t)code.a);
+        step_program();
+    }
+
+    void ShrekRuntime::run_superinstruction_steps(const Superinstruction& superinstruction)
+    {
+        // Each instruction runs through its own handler, so one that fails does so the same way it would alone.
+        auto start = m_program_counter;
+        for (std::size_t i = 0; i < superinstruction.op_codes.size(); ++i)
+        {
+            auto instruction = m_code[start + i];
+            instruction.op_code = superinstruction.op_codes[i];
+            execute_instruction(instruction);
+        }
+    }
+
+    void ShrekRuntime::op_superinstruction(const ByteCode& code)
+    {
+        const auto& superinstruction = m_superinstructions[(std::size_t)code.b];
+        const auto& op_codes = superinstruction.op_codes;
+        auto start = m_program_counter;
+        auto size = m_stack.size();
+
+        if (size < superinstruction.needs || (m_stack.max_depth() != ValueStack::unlimited_depth
+            && size + superinstruction.growth > m_stack.max_depth()))
+        {
+            run_superinstruction_steps(superinstruction);
+            return;
+        }
+
+        m_stack.reserve(superinstruction.growth);
+        auto* top = m_stack.data() + size;
+
+        // Expanded once for each position, so each has its own branch on the op code, which sees the same op code every
+        // time while one superinstruction is hot.
+#define SHREK_SUPERINSTRUCTION_STEP(i)                                                  \
+        switch (op_codes[i])                                                            \
+        {                                                                               \
+        case OpCode::push0:                                                             \
+            *top++ = 0;                                                                 \
+            break;                                                                      \
+        case OpCode::push_const:                                                        \
+            *top++ = instructions[i].a;                                                 \
+            break;                                                                      \
+        case OpCode::pop:                                                               \
+        case OpCode::pop_unchecked:                                                     \
+            --top;                                                                      \
+            break;                                                                      \
+        case OpCode::bump:                                                              \
+        case OpCode::bump_unchecked:                                                    \
+            ++top[-1];                                                                  \
+            break;                                                                      \
+        case OpCode::add_const:                                                         \
+        case OpCode::add_const_unchecked:                                               \
+            top[-1] += instructions[i].a;                                               \
+            break;                                                                      \
+        case OpCode::add:                                                               \
+        case OpCode::add_unchecked:                                                     \
+            top[-2] = top[-2] + top[-1];                                                \
+            --top;                                                                      \
+            break;                                                                      \
+        case OpCode::subtract:                                                          \
+        case OpCode::subtract_unchecked:                                                \
+            top[-2] = top[-2] - top[-1];                                                \
+            --top;                                                                      \
+            break;                                                                      \
+        case OpCode::multiply:                                                          \
+        case OpCode::multiply_unchecked:                                                \
+            top[-2] = top[-2] * top[-1];                                                \
+            --top;                                                                      \
+            break;                                                                      \
+        case OpCode::double_:                                                           \
+            top[-1] = top[-1] * 2;                                                      \
+            break;                                                                      \
+        case OpCode::negate:                                                            \
+            top[-1] = -top[-1];                                                         \
+            break;                                                                      \
+        case OpCode::clone:                                                             \
+            *top = top[-1];                                                             \
+            ++top;                                                                      \
+            break;                                                                      \
+        case OpCode::jmp:                                                               \
+            goto jump;                                                                  \
+        case OpCode::jz:                                                                \
+        case OpCode::jz_unchecked:                                                      \
+            if (top[-1] == 0)                                                           \
+            {                                                                           \
+                goto jump;                                                              \
+            }                                                                           \
+            break;                                                                      \
+        case OpCode::jneg:                                                              \
+        case OpCode::jneg_unchecked:                                                    \
+            if (top[-1] < 0)                                                            \
+            {                                                                           \
+                goto jump;                                                              \
+            }                                                                           \
+            break;                                                                      \
+        default:                                                                        \
+            break;                                                                      \
+        }
+
+        const auto* instructions = &m_code[start];
+        SHREK_SUPERINSTRUCTION_STEP(0);
+        SHREK_SUPERINSTRUCTION_STEP(1);
+        if (op_codes.size() > 2)
+        {
+            SHREK_SUPERINSTRUCTION_STEP(2);
+        }
+
+        if (op_codes.size() > 3)
+        {
+            SHREK_SUPERINSTRUCTION_STEP(3);
+        }
+
+#undef SHREK_SUPERINSTRUCTION_STEP
+
+        m_stack.set_size((std::size_t)(top - m_stack.data()));
+        m_program_counter = start + (std::size_t)code.c;
+        return;
+
+        // Jumps are only ever last. Taking one as a branch of its own, rather than choosing the next program counter
+        // from the value on top, keeps the jump predicted the way the jump instruction alone would be.
+    jump:
+        m_stack.set_size((std::size_t)(top - m_stack.data()));
+        m_program_counter = (std::size_t)instructions[code.c - 1].a;
+    }
+}
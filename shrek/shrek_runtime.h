@@ -1,65 +1,155 @@
-#ifndef _SHREK_RUNTIME_H_INCLUDE_GUARD
-#define _SHREK_RUNTIME_H_INCLUDE_GUARD
-
-#include "shrek.h"
-#include "shrek_types.h"
-
-#include <functional>
-#include <stack>
-#include <vector>
-#include <optional>
-
-namespace shrek
-{
-    struct RuntimeHooks
-    {
-        virtual ~RuntimeHooks() = default;
-
-        virtual void on_step() = 0;
-
-        virtual void on_runtime_error() = 0;
-    };
-
-    class ShrekRuntime
-    {
-        std::vector<ByteCode> m_code;
-        std::vector<std::size_t> m_jump_table;
-        std::size_t m_program_counter = 0;
-        RuntimeHooks* m_hooks = nullptr;
-        std::stack<int> m_stack;
-        std::unordered_map<int, ShrekFunc> m_func_table;
-        std::string m_func_exception;
-
-        // Handle for C API calls.
-        ShrekHandle* m_owning_handle;
-
-        void build_jump_table();
-        int main_loop();
-        void step_program();
-        std::size_t get_jump_location(int label_num);
-
-        void op_push0();
-        void op_pop();
-        void op_bump();
-        void op_func();
-        void op_jump();
-        void op_push_const();
-
-    public:
-        ShrekRuntime(ShrekHandle* owning_handle);
-
-        inline std::stack<int>& stack() { return m_stack; }
-
-        int run(int argc, const char** argv);
-
-        void set_hooks(RuntimeHooks* hooks);
-
-        const ByteCode& curr_code() const;
-
-        bool register_function(int func_number, ShrekFunc func);
-
-        void set_func_exception(const std::string& value);
-    };
-}
-
-#endif // !_SHREK_RUNTIME_H_INCLUDE_GUARD
+#ifndef _SHREK_RUNTIME_H_INCLUDE_GUARD
+#define _SHREK_RUNTIME_H_INCLUDE_GUARD
+
+#include "shrek.h"
+#include "shrek_function_table.h"
+#include "shrek_jit.h"
+#include "shrek_options.h"
+#include "shrek_superinstructions.h"
+#include "shrek_types.h"
+#include "shrek_value_stack.h"
+
+#include <functional>
+#include <vector>
+#include <optional>
+
+namespace shrek
+{
+    struct RuntimeHooks
+    {
+        virtual ~RuntimeHooks() = default;
+
+        virtual void on_step() = 0;
+
+        virtual void on_runtime_error() = 0;
+    };
+
+    class ShrekRuntime
+    {
+        std::vector<ByteCode> m_code;
+        std::size_t m_program_counter = 0;
+        RuntimeHooks* m_hooks = nullptr;
+        ValueStack m_stack;
+        FunctionTable m_func_table;
+        std::string m_func_exception;
+        std::size_t m_bound_calls = 0;
+        std::size_t m_dynamic_calls = 0;
+        std::vector<int> m_fast_results;
+        std::vector<Superinstruction> m_superinstructions;
+
+        // Times each instruction ran, under --profile.
+        std::vector<std::size_t> m_profile;
+
+        // Compiled code under --jit, and the exception an instruction it ran through the interpreter threw.
+        std::unique_ptr<JitProgram> m_jit;
+        std::exception_ptr m_jit_exception;
+        RuntimeOptions m_options;
+
+        // Handle for C API calls.
+        ShrekHandle* m_owning_handle;
+
+        // Interpreter loop policies, called before every instruction.
+        struct NoHooks;
+        struct StepHooks;
+        struct StepCounting;
+        struct Profiling;
+        struct Tracing;
+
+        int execute();
+
+        template <typename Policy>
+        int dispatch_loop();
+
+        template <typename Policy>
+        int main_loop();
+
+        template <typename Policy>
+        int threaded_loop();
+
+        int tos_loop();
+        void execute_instruction(const ByteCode& code);
+        int exit_code() const;
+        void step_program();
+        void load_superinstructions();
+        void write_profile();
+        void compile_program();
+        int run_compiled();
+        static std::size_t run_instruction_for_jit(JitContext* context, std::size_t index);
+
+        void op_push0();
+        void op_pop();
+        void op_bump();
+        void op_func();
+        void op_call_direct(const ByteCode& code);
+        void op_call_fast(const ByteCode& code);
+        void call_function(int func_num, ShrekFunc func);
+        void call_fast_function(int func_num, const FunctionEntry& function);
+        void rebind_calls();
+        void op_jump(const ByteCode& code);
+        void op_jmp(const ByteCode& code);
+        void op_jz(const ByteCode& code);
+        void op_jneg(const ByteCode& code);
+        void op_push_const(const ByteCode& code);
+        void op_add_const(const ByteCode& code);
+        void op_halt();
+
+        // Built-in functions, run directly against the stack instead of through the C API.
+        void op_intrinsic(OpCode op_code);
+        void op_input();
+        void op_output();
+        void op_add();
+        void op_subtract();
+        void op_multiply();
+        void op_divide();
+        void op_mod();
+        void op_double();
+        void op_negate();
+        void op_clone();
+
+        // Unchecked variants, only emitted where the stack is known to hold enough values.
+        void op_pop_unchecked();
+        void op_bump_unchecked();
+        void op_add_const_unchecked(const ByteCode& code);
+        void op_jz_unchecked(const ByteCode& code);
+        void op_jneg_unchecked(const ByteCode& code);
+        void op_add_unchecked();
+        void op_subtract_unchecked();
+        void op_multiply_unchecked();
+
+        // Register instructions, which read and write stack slots directly. See translate_to_registers.
+        void op_reg_set(const ByteCode& code);
+        void op_reg_move(const ByteCode& code);
+        void op_reg_add(const ByteCode& code);
+        void op_reg_add_imm(const ByteCode& code);
+        void op_reg_sub(const ByteCode& code);
+        void op_reg_rsub_imm(const ByteCode& code);
+        void op_reg_mul(const ByteCode& code);
+        void op_reg_mul_imm(const ByteCode& code);
+        void op_reg_jz(const ByteCode& code);
+        void op_reg_jneg(const ByteCode& code);
+        void op_reg_sync(const ByteCode& code);
+
+        // Runs a whole superinstruction, checking the stack once. See apply_superinstructions.
+        void op_superinstruction(const ByteCode& code);
+
+        // Run a superinstruction one instruction at a time, where the stack might not pass the checks it skips.
+        void run_superinstruction_steps(const Superinstruction& superinstruction);
+
+    public:
+        ShrekRuntime(ShrekHandle* owning_handle);
+
+        inline ValueStack& stack() { return m_stack; }
+
+        int run(int argc, const char** argv);
+
+        void set_hooks(RuntimeHooks* hooks);
+
+        const ByteCode& curr_code() const;
+
+        bool register_function(int func_number, const FunctionEntry& function);
+
+        void set_func_exception(const std::string& value);
+    };
+}
+
+#endif // !_SHREK_RUNTIME_H_INCLUDE_GUARD
@@ -0,0 +1,232 @@
+#include "shrek_stack_depth.h"
+
+#include <algorithm>
+
+#include "shrek_cfg.h"
+#include "shrek_function_table.h"
+
+namespace shrek
+{
+    // Values an instruction needs on the stack to run, and the change in depth once it has. Calls to functions that are
+    // not built-in can leave any number of values, so the depth after them is not known, unless the function declared
+    // its arity when it was registered.
+    struct StackEffect
+    {
+        std::size_t needs = 0;
+        int change = 0;
+        bool unknown = false;
+        bool unbounded = false;
+    };
+
+    // Times a block's range can grow before its most values are taken as unbounded, so loops that push reach a fixed
+    // point.
+    constexpr int widen_after = 8;
+
+    static StackEffect stack_effect(const ByteCode& code);
+    static OpCode unchecked_op_code(OpCode op_code);
+    static StackDepthRange apply_effect(const StackDepthRange& range, const StackEffect& effect);
+
+    StackDepthResult check_stack_depth(std::vector<ByteCode>& code)
+    {
+        StackDepthResult result;
+
+        auto depths = stack_depths(code);
+        for (std::size_t i = 0; i < code.size(); ++i)
+        {
+            if (!depths[i].reached)
+            {
+                continue;
+            }
+
+            auto effect = stack_effect(code[i]);
+
+            auto unchecked = unchecked_op_code(code[i].op_code);
+            if (unchecked != code[i].op_code && depths[i].min >= effect.needs)
+            {
+                code[i].op_code = unchecked;
+                ++result.unchecked;
+            }
+
+            result.max_depth = std::max(result.max_depth, apply_effect(depths[i], effect).max);
+        }
+
+        return result;
+    }
+
+    std::vector<StackDepthRange> stack_depths(const std::vector<ByteCode>& code)
+    {
+        std::vector<StackDepthRange> depths(code.size());
+
+        auto cfg = build_cfg(code);
+        if (cfg.blocks.empty())
+        {
+            return depths;
+        }
+
+        std::vector<StackDepthRange> entry(cfg.blocks.size());
+        std::vector<bool> visited(cfg.blocks.size(), false);
+        std::vector<int> updates(cfg.blocks.size(), 0);
+        std::vector<std::size_t> pending = { 0 };
+        visited[0] = true;
+
+        while (!pending.empty())
+        {
+            auto index = pending.back();
+            pending.pop_back();
+
+            const auto& block = cfg.blocks[index];
+            auto range = entry[index];
+            for (auto i = block.begin; i < block.end; ++i)
+            {
+                range = apply_effect(range, stack_effect(code[i]));
+            }
+
+            for (auto successor : { block.jump_target, block.next })
+            {
+                if (successor >= cfg.blocks.size())
+                {
+                    continue;
+                }
+
+                if (!visited[successor])
+                {
+                    visited[successor] = true;
+                    entry[successor] = range;
+                    pending.push_back(successor);
+                    continue;
+                }
+
+                auto merged = entry[successor];
+                merged.min = std::min(merged.min, range.min);
+                merged.max = std::max(merged.max, range.max);
+
+                if (merged.min != entry[successor].min || merged.max != entry[successor].max)
+                {
+                    if (merged.max != entry[successor].max && ++updates[successor] > widen_after)
+                    {
+                        merged.max = unbounded_depth;
+                    }
+
+                    entry[successor] = merged;
+                    pending.push_back(successor);
+                }
+            }
+        }
+
+        for (std::size_t index = 0; index < cfg.blocks.size(); ++index)
+        {
+            if (!visited[index])
+            {
+                continue;
+            }
+
+            const auto& block = cfg.blocks[index];
+            auto range = entry[index];
+            range.reached = true;
+            for (auto i = block.begin; i < block.end; ++i)
+            {
+                depths[i] = range;
+                range = apply_effect(range, stack_effect(code[i]));
+            }
+        }
+
+        return depths;
+    }
+
+    static StackEffect stack_effect(const ByteCode& code)
+    {
+        switch (code.op_code)
+        {
+        case OpCode::push0:
+        case OpCode::push_const:
+            return { 0, 1 };
+        case OpCode::pop:
+        case OpCode::pop_unchecked:
+            return { 1, -1 };
+        case OpCode::bump:
+        case OpCode::add_const:
+        case OpCode::jz:
+        case OpCode::jneg:
+        case OpCode::bump_unchecked:
+        case OpCode::add_const_unchecked:
+        case OpCode::jz_unchecked:
+        case OpCode::jneg_unchecked:
+        case OpCode::output:
+        case OpCode::double_:
+        case OpCode::negate:
+            return { 1, 0 };
+        case OpCode::jump:
+            return { 1, -1 };
+        case OpCode::func:
+            return { 1, 0, true };
+        case OpCode::call_direct:
+            return { 0, 0, true };
+        case OpCode::call_fast:
+            return { (std::size_t)code.function->arg_count, code.function->result_count - code.function->arg_count };
+        case OpCode::input:
+            return { 0, 1, false, true };
+        case OpCode::add:
+        case OpCode::subtract:
+        case OpCode::multiply:
+        case OpCode::divide:
+        case OpCode::mod:
+        case OpCode::add_unchecked:
+        case OpCode::subtract_unchecked:
+        case OpCode::multiply_unchecked:
+            return { 2, -1 };
+        case OpCode::clone:
+            return { 1, 1 };
+        default:
+            return {};
+        }
+    }
+
+    static OpCode unchecked_op_code(OpCode op_code)
+    {
+        switch (op_code)
+        {
+        case OpCode::pop:
+            return OpCode::pop_unchecked;
+        case OpCode::bump:
+            return OpCode::bump_unchecked;
+        case OpCode::add_const:
+            return OpCode::add_const_unchecked;
+        case OpCode::jz:
+            return OpCode::jz_unchecked;
+        case OpCode::jneg:
+            return OpCode::jneg_unchecked;
+        case OpCode::add:
+            return OpCode::add_unchecked;
+        case OpCode::subtract:
+            return OpCode::subtract_unchecked;
+        case OpCode::multiply:
+            return OpCode::multiply_unchecked;
+        default:
+            return op_code;
+        }
+    }
+
+    static StackDepthRange apply_effect(const StackDepthRange& range, const StackEffect& effect)
+    {
+        // An instruction that finds too few values stops the program, so past it the stack held at least what it needs.
+        StackDepthRange result;
+        result.reached = range.reached;
+        result.min = std::max(range.min, effect.needs) + effect.change;
+
+        if (range.max == unbounded_depth || effect.unbounded || effect.unknown)
+        {
+            result.max = unbounded_depth;
+        }
+        else
+        {
+            result.max = std::max(range.max, effect.needs) + effect.change;
+        }
+
+        if (effect.unknown)
+        {
+            result.min = 0;
+        }
+
+        return result;
+    }
+}
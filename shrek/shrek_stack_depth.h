@@ -0,0 +1,43 @@
+#ifndef _SHREK_STACK_DEPTH_H_INCLUDE_GUARD
+#define _SHREK_STACK_DEPTH_H_INCLUDE_GUARD
+
+#include <limits>
+
+#include "shrek_types.h"
+
+namespace shrek
+{
+    // Stack depth that no bound is known for, such as after input or a call to an extension function.
+    constexpr std::size_t unbounded_depth = std::numeric_limits<std::size_t>::max();
+
+    // Least and most values on the stack before an instruction. Instructions no path reaches are not reached.
+    struct StackDepthRange
+    {
+        std::size_t min = 0;
+        std::size_t max = 0;
+        bool reached = false;
+
+        // The depth is the same on every path, so it is known before the program runs.
+        bool exact() const { return reached && min == max && max != unbounded_depth; }
+    };
+
+    struct StackDepthResult
+    {
+        // Number of instructions replaced by their unchecked variant.
+        std::size_t unchecked = 0;
+
+        // Most values the stack can hold at any point of the program, or unbounded_depth.
+        std::size_t max_depth = 0;
+    };
+
+    // Work out the least and most values on the stack before each instruction, following every path through the control
+    // flow graph from an empty stack. Instructions that always find enough values are replaced by a variant that does
+    // not check the stack. Run on code that is not linked yet, after the other passes.
+    StackDepthResult check_stack_depth(std::vector<ByteCode>& code);
+
+    // Range of stack depths before each instruction of code that is not linked yet, found the same way as
+    // check_stack_depth.
+    std::vector<StackDepthRange> stack_depths(const std::vector<ByteCode>& code);
+}
+
+#endif // _SHREK_STACK_DEPTH_H_INCLUDE_GUARD
@@ -0,0 +1,340 @@
+#include "shrek_superinstructions.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include "fmt/format.h"
+
+#include "shrek_disassembler.h"
+
+namespace shrek
+{
+    // First line of a profile file, with the format version.
+    constexpr const char* profile_header = "shrek-superinstructions 1";
+
+    static bool matches(const std::vector<ByteCode>& code, const std::vector<bool>& taken, std::size_t index,
+        const Superinstruction& superinstruction);
+    static bool find_op_code(std::string_view name, OpCode& result);
+
+    bool can_fuse(OpCode op_code, bool last)
+    {
+        switch (op_code)
+        {
+        case OpCode::no_op:
+        case OpCode::push0:
+        case OpCode::push_const:
+        case OpCode::pop:
+        case OpCode::pop_unchecked:
+        case OpCode::bump:
+        case OpCode::bump_unchecked:
+        case OpCode::add_const:
+        case OpCode::add_const_unchecked:
+        case OpCode::add:
+        case OpCode::subtract:
+        case OpCode::multiply:
+        case OpCode::add_unchecked:
+        case OpCode::subtract_unchecked:
+        case OpCode::multiply_unchecked:
+        case OpCode::double_:
+        case OpCode::negate:
+        case OpCode::clone:
+            return true;
+        case OpCode::jmp:
+        case OpCode::jz:
+        case OpCode::jneg:
+        case OpCode::jz_unchecked:
+        case OpCode::jneg_unchecked:
+            return last;
+        default:
+            return false;
+        }
+    }
+
+    Superinstruction make_superinstruction(const std::vector<OpCode>& op_codes)
+    {
+        Superinstruction result;
+        result.op_codes = op_codes;
+
+        // Values on the stack relative to where the sequence starts.
+        std::ptrdiff_t depth = 0;
+        std::ptrdiff_t lowest = 0;
+        std::ptrdiff_t highest = 0;
+
+        for (auto op_code : op_codes)
+        {
+            std::ptrdiff_t needs = 0;
+            std::ptrdiff_t change = 0;
+
+            switch (op_code)
+            {
+            case OpCode::push0:
+            case OpCode::push_const:
+                change = 1;
+                break;
+            case OpCode::pop:
+            case OpCode::pop_unchecked:
+                needs = 1;
+                change = -1;
+                break;
+            case OpCode::add:
+            case OpCode::subtract:
+            case OpCode::multiply:
+            case OpCode::add_unchecked:
+            case OpCode::subtract_unchecked:
+            case OpCode::multiply_unchecked:
+                needs = 2;
+                change = -1;
+                break;
+            case OpCode::clone:
+                needs = 1;
+                change = 1;
+                break;
+            case OpCode::no_op:
+            case OpCode::jmp:
+                break;
+            default:
+                needs = 1;
+                break;
+            }
+
+            lowest = std::min(lowest, depth - needs);
+            depth += change;
+            highest = std::max(highest, depth);
+        }
+
+        result.needs = (std::size_t)-lowest;
+        result.growth = (std::size_t)highest;
+
+        return result;
+    }
+
+    SuperinstructionProfile select_superinstructions(const std::vector<ByteCode>& code,
+        const std::vector<std::size_t>& counts, std::size_t count)
+    {
+        SuperinstructionProfile profile;
+        std::vector<bool> taken(code.size(), false);
+
+        for (auto ran : counts)
+        {
+            profile.dispatches += ran;
+        }
+
+        while (profile.superinstructions.size() < count)
+        {
+            // Dispatches each sequence would remove, counting every site that starts where nothing is taken yet.
+            // Instructions before the last one do not jump, so every run of the first runs the whole sequence.
+            std::map<std::vector<OpCode>, std::size_t> candidates;
+            std::vector<OpCode> sequence;
+
+            for (std::size_t i = 0; i < code.size(); ++i)
+            {
+                if (counts[i] == 0 || taken[i])
+                {
+                    continue;
+                }
+
+                sequence.clear();
+                for (auto j = i; j < code.size() && j < i + max_superinstruction_length && !taken[j]; ++j)
+                {
+                    auto op_code = code[j].op_code;
+                    if (!can_fuse(op_code, true))
+                    {
+                        break;
+                    }
+
+                    sequence.push_back(op_code);
+                    if (sequence.size() > 1)
+                    {
+                        candidates[sequence] += counts[i] * (sequence.size() - 1);
+                    }
+
+                    if (!can_fuse(op_code, false))
+                    {
+                        break;
+                    }
+                }
+            }
+
+            const std::vector<OpCode>* best = nullptr;
+            std::size_t best_saved = 0;
+            for (const auto& [candidate, saved] : candidates)
+            {
+                if (saved > best_saved)
+                {
+                    best = &candidate;
+                    best_saved = saved;
+                }
+            }
+
+            if (!best)
+            {
+                break;
+            }
+
+            // Take the sites the same way apply_superinstructions does, so overlapping sites are only counted once.
+            auto superinstruction = make_superinstruction(*best);
+            for (std::size_t i = 0; i < code.size(); ++i)
+            {
+                if (matches(code, taken, i, superinstruction))
+                {
+                    std::fill(taken.begin() + (std::ptrdiff_t)i,
+                        taken.begin() + (std::ptrdiff_t)(i + best->size()), true);
+                    superinstruction.saved += counts[i] * (best->size() - 1);
+                }
+            }
+
+            profile.saved += superinstruction.saved;
+            profile.superinstructions.push_back(std::move(superinstruction));
+        }
+
+        return profile;
+    }
+
+    bool write_superinstruction_profile(const std::string& filename, const SuperinstructionProfile& profile)
+    {
+        auto text = fmt::format("{}\ndispatches {} saved {}\n", profile_header, profile.dispatches, profile.saved);
+        for (const auto& superinstruction : profile.superinstructions)
+        {
+            text += fmt::format("{}", superinstruction.saved);
+            for (auto op_code : superinstruction.op_codes)
+            {
+                text += fmt::format(" {}", op_code_name(op_code));
+            }
+
+            text += "\n";
+        }
+
+        std::ofstream fp(filename, std::ios::out | std::ios::trunc);
+        return fp.is_open() && fp.write(text.data(), text.size());
+    }
+
+    bool read_superinstruction_profile(const std::string& filename, SuperinstructionProfile& profile)
+    {
+        std::ifstream fp(filename);
+        std::string line;
+        if (!fp.is_open() || !std::getline(fp, line) || line != profile_header || !std::getline(fp, line))
+        {
+            return false;
+        }
+
+        std::istringstream totals(line);
+        std::string dispatches_word;
+        std::string saved_word;
+        if (!(totals >> dispatches_word >> profile.dispatches >> saved_word >> profile.saved)
+            || dispatches_word != "dispatches" || saved_word != "saved")
+        {
+            return false;
+        }
+
+        profile.superinstructions.clear();
+        while (std::getline(fp, line))
+        {
+            if (line.empty())
+            {
+                continue;
+            }
+
+            std::istringstream fields(line);
+            std::size_t saved = 0;
+            if (!(fields >> saved))
+            {
+                return false;
+            }
+
+            std::vector<OpCode> op_codes;
+            std::string name;
+            while (fields >> name)
+            {
+                OpCode op_code;
+                if (!find_op_code(name, op_code))
+                {
+                    return false;
+                }
+
+                op_codes.push_back(op_code);
+            }
+
+            if (op_codes.size() < 2 || op_codes.size() > max_superinstruction_length)
+            {
+                return false;
+            }
+
+            for (std::size_t i = 0; i < op_codes.size(); ++i)
+            {
+                if (!can_fuse(op_codes[i], i + 1 == op_codes.size()))
+                {
+                    return false;
+                }
+            }
+
+            profile.superinstructions.push_back(make_superinstruction(op_codes));
+            profile.superinstructions.back().saved = saved;
+        }
+
+        return true;
+    }
+
+    std::size_t apply_superinstructions(std::vector<ByteCode>& code,
+        const std::vector<Superinstruction>& superinstructions)
+    {
+        std::vector<bool> taken(code.size(), false);
+        std::size_t sites = 0;
+
+        for (std::size_t s = 0; s < superinstructions.size(); ++s)
+        {
+            const auto& superinstruction = superinstructions[s];
+            for (std::size_t i = 0; i < code.size(); ++i)
+            {
+                if (!matches(code, taken, i, superinstruction))
+                {
+                    continue;
+                }
+
+                std::fill(taken.begin() + (std::ptrdiff_t)i,
+                    taken.begin() + (std::ptrdiff_t)(i + superinstruction.op_codes.size()), true);
+
+                code[i].op_code = OpCode::superinstruction;
+                code[i].b = (int)s;
+                code[i].c = (int)superinstruction.op_codes.size();
+                ++sites;
+            }
+        }
+
+        return sites;
+    }
+
+    static bool matches(const std::vector<ByteCode>& code, const std::vector<bool>& taken, std::size_t index,
+        const Superinstruction& superinstruction)
+    {
+        const auto& op_codes = superinstruction.op_codes;
+        if (index + op_codes.size() > code.size())
+        {
+            return false;
+        }
+
+        for (std::size_t i = 0; i < op_codes.size(); ++i)
+        {
+            if (taken[index + i] || code[index + i].op_code != op_codes[i])
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    static bool find_op_code(std::string_view name, OpCode& result)
+    {
+        for (std::size_t i = 0; i < op_code_count; ++i)
+        {
+            if (name == op_code_name((OpCode)i))
+            {
+                result = (OpCode)i;
+                return true;
+            }
+        }
+
+        return false;
+    }
+}
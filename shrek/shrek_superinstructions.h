@@ -0,0 +1,64 @@
+#ifndef _SHREK_SUPERINSTRUCTIONS_H_INCLUDE_GUARD
+#define _SHREK_SUPERINSTRUCTIONS_H_INCLUDE_GUARD
+
+#include <string>
+#include <vector>
+
+#include "shrek_types.h"
+
+namespace shrek
+{
+    // Longest sequence of instructions run by one superinstruction.
+    constexpr std::size_t max_superinstruction_length = 4;
+
+    // Sequences chosen by a profiling run when --superinstruction-count is not given.
+    constexpr std::size_t default_superinstruction_count = 8;
+
+    // A sequence of instructions run with one dispatch. Each site keeps its instructions in the code, with the first
+    // one's op code replaced by OpCode::superinstruction, so op_codes holds the op codes the site had.
+    struct Superinstruction
+    {
+        std::vector<OpCode> op_codes;
+
+        // Values the sequence needs on the stack, and the most values it adds to it, so the stack is only checked once.
+        std::size_t needs = 0;
+        std::size_t growth = 0;
+
+        // Dispatches it removed from the profiling run it was chosen in.
+        std::size_t saved = 0;
+    };
+
+    struct SuperinstructionProfile
+    {
+        // In the order they are applied, which is the order they were chosen in.
+        std::vector<Superinstruction> superinstructions;
+
+        // Dispatches in the profiling run, and how many the superinstructions removed from it.
+        std::size_t dispatches = 0;
+        std::size_t saved = 0;
+    };
+
+    // True if op_code can be part of a superinstruction, at its end if last is set. Only instructions that cannot fail
+    // once the stack holds enough values, with jumps at the end.
+    bool can_fuse(OpCode op_code, bool last);
+
+    Superinstruction make_superinstruction(const std::vector<OpCode>& op_codes);
+
+    // Choose up to count sequences in linked code, given the number of times each instruction ran. Each round takes
+    // the sequence that removes the most dispatches at sites that do not overlap one already taken.
+    SuperinstructionProfile select_superinstructions(const std::vector<ByteCode>& code,
+        const std::vector<std::size_t>& counts, std::size_t count);
+
+    bool write_superinstruction_profile(const std::string& filename, const SuperinstructionProfile& profile);
+
+    // Returns false if the file cannot be read or lists a sequence that cannot be a superinstruction.
+    bool read_superinstruction_profile(const std::string& filename, SuperinstructionProfile& profile);
+
+    // Replace the first instruction of every site of each superinstruction in linked code, with b holding the index
+    // in superinstructions. A site overlapping one replaced before it is left alone. Jumps into the middle of a site
+    // run the rest of it one instruction at a time. Returns the number of sites.
+    std::size_t apply_superinstructions(std::vector<ByteCode>& code,
+        const std::vector<Superinstruction>& superinstructions);
+}
+
+#endif // _SHREK_SUPERINSTRUCTIONS_H_INCLUDE_GUARD
@@ -1,92 +1,185 @@
-#ifndef _SHREK_TYPES_H_INCLUDE_GUARD
-#define _SHREK_TYPES_H_INCLUDE_GUARD
-
-#include <exception>
-#include <memory>
-#include <string>
-#include <unordered_map>
-#include <vector>
-
-namespace shrek
-{
-    enum class OpCode
-    {
-        no_op,
-        label,
-        push0,
-        pop,
-        bump,
-        func,
-        jump,
-        push_const
-    };
-
-    enum class TokenType
-    {
-        whitespace,
-        command,
-        label,
-        comment
-    };
-
-    struct Token
-    {
-        TokenType token_type = TokenType::whitespace;
-        std::string value;
-        std::size_t index;
-    };
-
-    struct SyntaxTreeNode
-    {
-        Token token;
-        std::vector<SyntaxTreeNode> children;
-    };
-
-    struct SyntaxTree
-    {
-        std::vector<SyntaxTreeNode> syntax;
-    };
-
-    struct ByteCode
-    {
-        std::size_t source_code_index;
-        OpCode op_code = OpCode::no_op;
-        int a = 0;
-    };
-
-    class SyntaxError
-    {
-    public:
-        SyntaxError(const std::string& what, std::size_t index, const std::string& token)
-            : m_what(what)
-            , m_index(index)
-            , m_token(token)
-        {}
-
-        const std::string& what() const { return m_what; }
-
-        std::size_t index() const { return m_index; }
-
-        const std::string& token() const { return m_token; }
-
-    private:
-        std::string m_what;
-        std::size_t m_index;
-        std::string m_token;
-    };
-
-    class RuntimeError
-    {
-    public:
-        RuntimeError(const std::string& what)
-            : m_what(what)
-        {}
-
-        const std::string& what() const { return m_what; }
-
-    private:
-        std::string m_what;
-    };
-}
-
-#endif // _SHREK_TYPES_H_INCLUDE_GUARD
+#ifndef _SHREK_TYPES_H_INCLUDE_GUARD
+#define _SHREK_TYPES_H_INCLUDE_GUARD
+
+#include <exception>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "shrek.h"
+
+namespace shrek
+{
+    struct FunctionEntry;
+
+    enum class OpCode
+    {
+        no_op,
+        label,
+        push0,
+        pop,
+        bump,
+        func,
+        jump,
+        jmp,
+        jz,
+        jneg,
+        push_const,
+        add_const,
+        call_direct,
+        call_fast,
+
+        // Built-in functions run in place of a func call. Must stay in function number order.
+        input,
+        output,
+        add,
+        subtract,
+        multiply,
+        divide,
+        mod,
+        double_,
+        negate,
+        clone,
+
+        // Variants that do not check the stack, used where check_stack_depth proves it holds enough values.
+        pop_unchecked,
+        bump_unchecked,
+        add_const_unchecked,
+        jz_unchecked,
+        jneg_unchecked,
+        add_unchecked,
+        subtract_unchecked,
+        multiply_unchecked,
+
+        // Register instructions, emitted by translate_to_registers. Registers are stack slots counted from the bottom
+        // of the stack, see ByteCode for the operands.
+        reg_set,
+        reg_move,
+        reg_add,
+        reg_add_imm,
+        reg_sub,
+        reg_rsub_imm,
+        reg_mul,
+        reg_mul_imm,
+        reg_jz,
+        reg_jneg,
+        reg_sync,
+
+        // Runs the sequence of instructions starting here, with b the index of the superinstruction and c the number of
+        // instructions in it. Only put in linked code by apply_superinstructions.
+        superinstruction,
+
+        halt
+    };
+
+    constexpr std::size_t op_code_count = (std::size_t)OpCode::halt + 1;
+
+    constexpr int intrinsic_count = (int)OpCode::clone - (int)OpCode::input + 1;
+
+    inline bool is_intrinsic(OpCode op_code)
+    {
+        return op_code >= OpCode::input && op_code <= OpCode::clone;
+    }
+
+    // Op code of the built-in function with the given number, which must be less than intrinsic_count.
+    inline OpCode intrinsic_op_code(int func_number)
+    {
+        return (OpCode)((int)OpCode::input + func_number);
+    }
+
+    inline int intrinsic_func_number(OpCode op_code)
+    {
+        return (int)op_code - (int)OpCode::input;
+    }
+
+    inline bool is_register_op(OpCode op_code)
+    {
+        return op_code >= OpCode::reg_set && op_code <= OpCode::reg_sync;
+    }
+
+    // Jumps hold a label number in a until the code is linked, and the target byte code position after.
+    inline bool is_jump(OpCode op_code)
+    {
+        return op_code == OpCode::jump || op_code == OpCode::jmp || op_code == OpCode::jz || op_code == OpCode::jneg
+            || op_code == OpCode::jz_unchecked || op_code == OpCode::jneg_unchecked || op_code == OpCode::reg_jz
+            || op_code == OpCode::reg_jneg;
+    }
+
+    enum class TokenType
+    {
+        whitespace,
+        command,
+        label,
+        comment
+    };
+
+    struct Token
+    {
+        TokenType token_type = TokenType::whitespace;
+        std::string value;
+        std::size_t index;
+    };
+
+    struct SyntaxTreeNode
+    {
+        Token token;
+        std::vector<SyntaxTreeNode> children;
+    };
+
+    struct SyntaxTree
+    {
+        std::vector<SyntaxTreeNode> syntax;
+    };
+
+    struct ByteCode
+    {
+        std::size_t source_code_index;
+        OpCode op_code = OpCode::no_op;
+        int a = 0;
+
+        // Register instructions write register b, read register c as their left operand, and hold the right operand in
+        // a, either a register or an immediate value. Register jumps test register b.
+        int b = 0;
+        int c = 0;
+
+        // Function bound to a call_direct or call_fast, which hold the function number in a.
+        const FunctionEntry* function = nullptr;
+    };
+
+    class SyntaxError
+    {
+    public:
+        SyntaxError(const std::string& what, std::size_t index, const std::string& token)
+            : m_what(what)
+            , m_index(index)
+            , m_token(token)
+        {}
+
+        const std::string& what() const { return m_what; }
+
+        std::size_t index() const { return m_index; }
+
+        const std::string& token() const { return m_token; }
+
+    private:
+        std::string m_what;
+        std::size_t m_index;
+        std::string m_token;
+    };
+
+    class RuntimeError
+    {
+    public:
+        RuntimeError(const std::string& what)
+            : m_what(what)
+        {}
+
+        const std::string& what() const { return m_what; }
+
+    private:
+        std::string m_what;
+    };
+}
+
+#endif // _SHREK_TYPES_H_INCLUDE_GUARD
@@ -0,0 +1,52 @@
+#include "shrek_value_stack.h"
+
+#include <algorithm>
+#include "fmt/format.h"
+
+#include "shrek_types.h"
+
+namespace shrek
+{
+    ValueStack::ValueStack()
+    {
+        reset(default_capacity, unlimited_depth);
+    }
+
+    void ValueStack::reset(std::size_t initial_capacity, std::size_t max_depth)
+    {
+        m_max_depth = max_depth;
+
+        if (m_max_depth != unlimited_depth)
+        {
+            initial_capacity = std::min(initial_capacity, m_max_depth);
+        }
+
+        m_buffer.assign(std::max<std::size_t>(initial_capacity, 1), 0);
+        m_begin = m_buffer.data();
+        m_top = m_begin;
+        m_end = m_begin + m_buffer.size();
+    }
+
+    void ValueStack::grow(std::size_t count)
+    {
+        auto used = size();
+        auto needed = used + count;
+
+        if (m_max_depth != unlimited_depth && needed > m_max_depth)
+        {
+            throw RuntimeError(fmt::format("Stack overflow, maximum depth is {}", m_max_depth));
+        }
+
+        // Geometric growth, capped at the maximum depth.
+        auto capacity = std::max(needed, m_buffer.size() * 2);
+        if (m_max_depth != unlimited_depth)
+        {
+            capacity = std::min(capacity, m_max_depth);
+        }
+
+        m_buffer.resize(capacity);
+        m_begin = m_buffer.data();
+        m_top = m_begin + used;
+        m_end = m_begin + m_buffer.size();
+    }
+}
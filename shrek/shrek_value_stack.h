@@ -0,0 +1,98 @@
+#ifndef _SHREK_VALUE_STACK_H_INCLUDE_GUARD
+#define _SHREK_VALUE_STACK_H_INCLUDE_GUARD
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace shrek
+{
+    // Value stack of the runtime, stored in one contiguous buffer with a cached top pointer. Push, pop and peek do not
+    // check for underflow; callers check empty() or size() first, the same as with std::stack. Pushing past the
+    // maximum depth throws a RuntimeError.
+    class ValueStack
+    {
+    public:
+        static constexpr std::size_t default_capacity = 1024;
+        static constexpr std::size_t unlimited_depth = 0;
+
+        ValueStack();
+
+        // Drop all values and set the initial capacity and maximum depth (unlimited_depth for no limit).
+        void reset(std::size_t initial_capacity, std::size_t max_depth);
+
+        inline bool empty() const { return m_top == m_begin; }
+
+        inline std::size_t size() const { return (std::size_t)(m_top - m_begin); }
+
+        inline std::size_t max_depth() const { return m_max_depth; }
+
+        // Values the stack holds before it has to grow.
+        inline std::size_t capacity() const { return (std::size_t)(m_end - m_begin); }
+
+        inline int& top() { return m_top[-1]; }
+
+        inline int top() const { return m_top[-1]; }
+
+        // Value n places below the top. peek(0) is the top of the stack.
+        inline int& peek(std::size_t n) { return m_top[-1 - (std::ptrdiff_t)n]; }
+
+        inline int peek(std::size_t n) const { return m_top[-1 - (std::ptrdiff_t)n]; }
+
+        inline void push(int value)
+        {
+            if (m_top == m_end)
+            {
+                grow(1);
+            }
+
+            *m_top++ = value;
+        }
+
+        inline void pop() { --m_top; }
+
+        // Push count values, the last one ending up on top.
+        inline void push_n(const int* values, std::size_t count)
+        {
+            reserve(count);
+            m_top = std::copy(values, values + count, m_top);
+        }
+
+        // Push count values, the first one ending up on top.
+        inline void push_n_reversed(const int* values, std::size_t count)
+        {
+            reserve(count);
+            m_top = std::reverse_copy(values, values + count, m_top);
+        }
+
+        // Drop the top count values. The stack must hold at least that many.
+        inline void pop_n(std::size_t count) { m_top -= count; }
+
+        // Set the number of values without writing them, so values written past the top through data() become part of
+        // the stack. The size must not pass the capacity made with reserve.
+        inline void set_size(std::size_t size) { m_top = m_begin + size; }
+
+        // Bottom of the stack. Values are stored bottom to top, so data()[size() - 1] is the top.
+        inline int* data() { return m_begin; }
+
+        // Make room for count more values without growing again.
+        inline void reserve(std::size_t count)
+        {
+            if ((std::size_t)(m_end - m_top) < count)
+            {
+                grow(count);
+            }
+        }
+
+    private:
+        std::vector<int> m_buffer;
+        int* m_begin = nullptr;
+        int* m_top = nullptr;
+        int* m_end = nullptr;
+        std::size_t m_max_depth = unlimited_depth;
+
+        void grow(std::size_t count);
+    };
+}
+
+#endif // _SHREK_VALUE_STACK_H_INCLUDE_GUARD
@@ -0,0 +1,212 @@
+// Function call benchmark. Runs SHREK loops through shrek_run that call an extension function on every trip, and
+// reports the time per call once the time of the same loop without the call is taken off. Where only constants are
+// folded, the loops push the function number and every call looks it up in the function table when it runs: by index
+// for numbers below --func-table-size, and through the hash table for the rest. With the default passes, bind-calls
+// binds the calls to the function, so they show what the calling convention costs on its own.
+//
+// Usage: shrek_call_bench [calls in millions, default 10]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "shrek.h"
+#include "shrek_builtins.h"
+
+namespace fs = std::filesystem;
+
+// Below the default --func-table-size of 1024, like the demo extension's numbers, and above it.
+constexpr int dense_number = 100;
+constexpr int sparse_number = 100000;
+
+// The same adder, registered with each calling convention.
+constexpr int popping_adder_number = 101;
+constexpr int fast_adder_number = 102;
+
+struct CallCase
+{
+    const char* name;
+
+    // Function the loop calls on every trip, or -1 for the loop alone. Calls after a loop alone are measured against
+    // it.
+    int func_number;
+
+    // Passes to run, or nullptr for the default passes.
+    const char* passes;
+
+    // Option added to the command line, or nullptr.
+    const char* option;
+
+    // Push a 0 before the call, for an adder to add to the loop counter.
+    bool operand = false;
+};
+
+static int noop(ShrekHandle* shrek)
+{
+    return SHREK_OK;
+}
+
+static int popping_adder(ShrekHandle* shrek)
+{
+    int a = 0;
+    int b = 0;
+    if (shrek_pop(shrek, &b) != SHREK_OK || shrek_pop(shrek, &a) != SHREK_OK)
+    {
+        shrek_set_except(shrek, "popping_adder needs two values");
+        return SHREK_ERROR;
+    }
+
+    return shrek_push(shrek, a + b);
+}
+
+static int fast_adder(ShrekHandle* shrek, const int* args, int* results)
+{
+    results[0] = args[0] + args[1];
+    return SHREK_OK;
+}
+
+// Pushes the number. Folded into a single push_const.
+static std::string push_number(int number)
+{
+    return "S" + std::string((std::size_t)number, 'R');
+}
+
+// A loop that makes the given number of trips and runs body on each. The trip count is built from its binary digits
+// with the double built-in, and the loop counts down to 0 with subtract.
+static std::string loop_source(std::size_t trips, const std::string& body)
+{
+    std::string code = "S";
+    for (int bit = 63; bit >= 0; --bit)
+    {
+        if ((trips >> bit) == 0)
+        {
+            continue;
+        }
+
+        code += " SRRRRRRRE";
+        if ((trips >> bit) & 1)
+        {
+            code += " R";
+        }
+    }
+
+    code += "\n!S!\n" + body + "\nSR SRRRE\nSRK!E!\nSK!S!\n!E!\n";
+    return code;
+}
+
+// Best of five runs of the program, in seconds, or a negative number if the program failed.
+static double measure(const fs::path& file, const CallCase& call_case)
+{
+    auto file_name = file.string();
+    auto passes = std::string("--passes=") + (call_case.passes ? call_case.passes : "");
+    std::vector<const char*> args = { "shrek_call_bench", "--no-cache" };
+    if (call_case.passes)
+    {
+        args.push_back(passes.c_str());
+    }
+    if (call_case.option)
+    {
+        args.push_back(call_case.option);
+    }
+    args.push_back(file_name.c_str());
+
+    double best = 0;
+    for (int run = 0; run < 5; ++run)
+    {
+        auto shrek = shrek_new_runtime();
+        shrek_builtins_register(shrek);
+        shrek_register_func(shrek, dense_number, noop);
+        shrek_register_func(shrek, sparse_number, noop);
+        shrek_register_func(shrek, popping_adder_number, popping_adder);
+        shrek_register_func_fast(shrek, fast_adder_number, fast_adder, 2, 1);
+
+        auto start = std::chrono::steady_clock::now();
+        int rc = shrek_run(shrek, (int)args.size(), args.data());
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        shrek_free_runtime(shrek);
+
+        if (rc != 0)
+        {
+            return -1;
+        }
+
+        if (best == 0 || elapsed.count() < best)
+        {
+            best = elapsed.count();
+        }
+    }
+
+    return best;
+}
+
+int main(int argc, const char** argv)
+{
+    std::size_t calls = 10u * 1000 * 1000;
+    if (argc > 1)
+    {
+        calls = (std::size_t)std::strtoull(argv[1], nullptr, 10) * 1000 * 1000;
+    }
+
+    if (calls == 0)
+    {
+        std::printf("Usage: shrek_call_bench [calls in millions, default 10]\n");
+        return 1;
+    }
+
+    const char* fold = "fold-constants";
+    const CallCase cases[] = {
+        { "loop alone", -1, fold, nullptr },
+        { "dense", dense_number, fold, nullptr },
+        { "sparse, table size 0", dense_number, fold, "--func-table-size=0" },
+        { "sparse, number 100000", sparse_number, fold, nullptr },
+        { "ShrekFunc adder", popping_adder_number, fold, nullptr, true },
+        { "ShrekFastFunc adder", fast_adder_number, fold, nullptr, true },
+        { "loop alone, default passes", -1, nullptr, nullptr },
+        { "ShrekFunc adder, bound", popping_adder_number, nullptr, nullptr, true },
+        { "ShrekFastFunc adder, bound", fast_adder_number, nullptr, nullptr, true },
+    };
+
+    auto file = fs::temp_directory_path() / "shrek_call_bench.shrek";
+
+    std::printf("%-28s %10s %10s\n", "calls", "seconds", "ns/call");
+
+    double loop_time = 0;
+    for (const auto& call_case : cases)
+    {
+        std::string body;
+        if (call_case.func_number >= 0)
+        {
+            body = (call_case.operand ? "S " : "") + push_number(call_case.func_number) + " E";
+        }
+        {
+            std::ofstream out(file, std::ios::binary);
+            out << loop_source(calls, body);
+        }
+
+        auto seconds = measure(file, call_case);
+        if (seconds < 0)
+        {
+            std::printf("The %s loop failed\n", call_case.name);
+            fs::remove(file);
+            return 1;
+        }
+
+        if (call_case.func_number < 0)
+        {
+            loop_time = seconds;
+            std::printf("%-28s %10.3f\n", call_case.name, seconds);
+        }
+        else
+        {
+            std::printf("%-28s %10.3f %10.2f\n", call_case.name, seconds, (seconds - loop_time) * 1e9 / (double)calls);
+        }
+    }
+
+    fs::remove(file);
+    return 0;
+}
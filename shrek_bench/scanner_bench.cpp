@@ -0,0 +1,211 @@
+// Scanner throughput benchmark. Generates sources from 1 KB to 100 MB and reports how many MB of source per second
+// the regex tokenizer the parser used to have, and the scalar and SIMD scanners, turn into tokens. Every token the
+// scanners produce is checked against the regex tokenizer, so the benchmark also fails if they disagree.
+//
+// Usage: shrek_bench [max size in MB, default 100]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <regex>
+#include <string>
+
+#include "shrek_lexer.h"
+#include "shrek_types.h"
+
+using namespace shrek;
+
+struct ScanSummary
+{
+    std::size_t tokens = 0;
+    std::size_t checksum = 0;
+
+    bool operator==(const ScanSummary& other) const
+    {
+        return tokens == other.tokens && checksum == other.checksum;
+    }
+};
+
+static void add_token(ScanSummary& summary, TokenType type, std::size_t index, std::size_t size)
+{
+    ++summary.tokens;
+    summary.checksum = summary.checksum * 31 + index * 7 + size * 3 + (std::size_t)type;
+}
+
+// The tokenizer as it was before the table-driven scanner, kept as the reference for the token stream and the speed.
+static std::size_t regex_next_token(const std::string& code, std::size_t index, TokenType& type, std::size_t& size)
+{
+    static std::regex label_regex(R"_(![SHREK]+!)_");
+    static std::regex cmd_regex(R"_([SHREK])_");
+    static std::regex whitespace_regex(R"_(\s+)_");
+    static std::regex comment_regex(R"_(#[^\n]*\n?)_");
+
+    std::smatch m;
+    if (std::regex_search(code.begin() + index, code.end(), m, label_regex, std::regex_constants::match_continuous))
+    {
+        type = TokenType::label;
+    }
+    else if (std::regex_search(code.begin() + index, code.end(), m, cmd_regex, std::regex_constants::match_continuous))
+    {
+        type = TokenType::command;
+    }
+    else if (std::regex_search(code.begin() + index, code.end(), m, whitespace_regex, std::regex_constants::match_continuous))
+    {
+        type = TokenType::whitespace;
+    }
+    else if (std::regex_search(code.begin() + index, code.end(), m, comment_regex, std::regex_constants::match_continuous))
+    {
+        type = TokenType::comment;
+    }
+    else
+    {
+        throw SyntaxError("Invalid token", index, code.substr(index, 1));
+    }
+
+    size = (std::size_t)m.length();
+    return index + size;
+}
+
+static ScanSummary scan_regex(const std::string& code)
+{
+    ScanSummary summary;
+    std::size_t index = 0;
+
+    while (index < code.size())
+    {
+        TokenType type;
+        std::size_t size;
+        auto start = index;
+        index = regex_next_token(code, index, type, size);
+        add_token(summary, type, start, size);
+    }
+
+    return summary;
+}
+
+static ScanSummary scan_table(const std::string& code, LexerBackend backend)
+{
+    const auto& scan = scan_routines(backend);
+
+    ScanSummary summary;
+    std::size_t index = 0;
+
+    while (index < code.size())
+    {
+        TokenView token;
+        index = next_token(code, index, scan, token);
+        add_token(summary, token.token_type, token.index, token.value.size());
+    }
+
+    return summary;
+}
+
+// Code shaped like generated programs: runs of commands, labels, indentation and short comments. Comments are kept
+// short because long ones overflow the stack inside the regex matcher.
+static std::string generate_source(std::size_t size, unsigned seed)
+{
+    static const char letters[] = "SHREK";
+
+    std::mt19937 random(seed);
+    std::string code;
+    code.reserve(size + 128);
+
+    while (code.size() < size)
+    {
+        switch (random() % 8)
+        {
+        case 0:
+        case 1:
+        case 2:
+            for (auto n = 1 + random() % 12; n > 0; --n)
+            {
+                code += letters[random() % 5];
+            }
+            break;
+        case 3:
+            code += '!';
+            for (auto n = 1 + random() % 6; n > 0; --n)
+            {
+                code += letters[random() % 5];
+            }
+            code += '!';
+            break;
+        case 4:
+        case 5:
+            code += ' ';
+            break;
+        case 6:
+            code += "\n    ";
+            break;
+        case 7:
+            code += "# push the next address\n";
+            break;
+        }
+    }
+
+    return code;
+}
+
+template <typename Scan>
+static double measure(const std::string& code, ScanSummary& summary, Scan scan)
+{
+    // Repeat small inputs so the timer has something to measure, and keep the best run.
+    using clock = std::chrono::steady_clock;
+
+    double best = 0;
+    auto deadline = clock::now() + std::chrono::milliseconds(200);
+
+    do
+    {
+        auto start = clock::now();
+        summary = scan(code);
+        std::chrono::duration<double> elapsed = clock::now() - start;
+
+        if (best == 0 || elapsed.count() < best)
+        {
+            best = elapsed.count();
+        }
+    } while (clock::now() < deadline);
+
+    return (double)code.size() / (1024.0 * 1024.0) / best;
+}
+
+int main(int argc, const char** argv)
+{
+    std::size_t max_size = 100u * 1024 * 1024;
+    if (argc > 1)
+    {
+        max_size = (std::size_t)std::strtoull(argv[1], nullptr, 10) * 1024 * 1024;
+    }
+
+    std::printf("%12s %12s %12s %12s %10s\n", "size", "regex MB/s", "scalar MB/s", "simd MB/s", "speedup");
+
+    const std::size_t kb = 1024, mb = 1024 * 1024;
+    for (auto size : { kb, 10 * kb, 100 * kb, mb, 10 * mb, 100 * mb })
+    {
+        if (size > max_size)
+        {
+            break;
+        }
+
+        auto code = generate_source(size, (unsigned)size);
+
+        ScanSummary regex, scalar, simd;
+        auto regex_rate = measure(code, regex, scan_regex);
+        auto scalar_rate = measure(code, scalar, [](const std::string& c) { return scan_table(c, LexerBackend::scalar); });
+        auto simd_rate = measure(code, simd, [](const std::string& c) { return scan_table(c, LexerBackend::simd); });
+
+        if (!(regex == scalar) || !(regex == simd))
+        {
+            std::printf("Scanners disagree on the %zu byte source\n", code.size());
+            return 1;
+        }
+
+        auto best = scalar_rate > simd_rate ? scalar_rate : simd_rate;
+        std::printf("%12zu %12.2f %12.2f %12.2f %9.0fx\n", code.size(), regex_rate, scalar_rate, simd_rate,
+            best / regex_rate);
+    }
+
+    return 0;
+}
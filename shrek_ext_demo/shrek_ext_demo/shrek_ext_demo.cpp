@@ -1,18 +1,31 @@
-#include <shrek.h>
-
-#include <stdio.h>
-
-extern "C"
-{
-    int demo_func(ShrekHandle* shrek)
-    {
-        puts("This is from an extension!\n");
-        return SHREK_OK;
-    }
-
-    __declspec(dllexport) int shrek_ext_demo_register(ShrekHandle* shrek)
-    {
-        int rc = shrek_register_func(shrek, 100, demo_func);
-        return rc;
-    }
-}
+#include <shrek.h>
+
+#include <stdio.h>
+
+extern "C"
+{
+    int demo_func(ShrekHandle* shrek)
+    {
+        puts("This is from an extension!\n");
+        return SHREK_OK;
+    }
+
+    // Uses the fast calling convention: gets its two arguments bottom to top and returns their sum.
+    int demo_sum(ShrekHandle* shrek, const int* args, int* results)
+    {
+        results[0] = args[0] + args[1];
+        return SHREK_OK;
+    }
+
+    shrek_EXPORTED_SYMBOL int shrek_ext_demo_register(ShrekHandle* shrek)
+    {
+        int rc = shrek_register_func(shrek, 100, demo_func);
+        if (rc != SHREK_OK)
+        {
+            return rc;
+        }
+
+        rc = shrek_register_func_fast(shrek, 101, demo_sum, 2, 1);
+        return rc;
+    }
+}
@@ -0,0 +1,32 @@
+#ifdef _WIN32
+#error Incorrect platform
+#endif
+
+#include <cstdio>
+#include <iostream>
+
+#include "shrek.h"
+#include "shrek_builtins.h"
+
+int main(int argc, const char** argv)
+{
+    setvbuf(stdout, nullptr, _IOFBF, 4096);
+
+    auto shrek = shrek_new_runtime();
+    if (!shrek)
+    {
+        std::cout << "Shrek runtime initialization failure" << std::endl;
+        return -1;
+    }
+
+    if (shrek_builtins_register(shrek) != SHREK_OK)
+    {
+        std::cout << "Failed to register built in functions" << std::endl;
+        shrek_free_runtime(shrek);
+        return -1;
+    }
+
+    int rc = shrek_run(shrek, argc, argv);
+    shrek_free_runtime(shrek);
+    return rc;
+}
@@ -0,0 +1,309 @@
+#!/usr/bin/env python3
+"""Regression tests for the SHREK runtime.
+
+Usage: python3 tests/run_tests.py <path to shrek> [--module <file.dnky>]...
+
+Programs in tests/programs are run and their output compared with the .out file next to them. Those programs and the
+samples at the top of the repository are also run with and without --jit, and must print the same output and exit
+with the same code either way. Other tests are functions in this file. Every test runs the runtime in a fresh working
+directory, so byte code caches and extension modules from one test never leak into another. Modules passed with
+--module are copied into that directory, which is where the runtime discovers them.
+"""
+
+import argparse
+import os
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+
+TIMEOUT = 10
+PROGRAMS = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'programs')
+
+# Sample programs at the top of the repository, which are only run to compare the JIT with the interpreter.
+SAMPLES = [os.path.join(os.path.dirname(os.path.dirname(os.path.abspath(__file__))), f)
+           for f in ('demo.shrek', 'ext_test.shrek')]
+
+tests = []
+
+
+def test(function):
+    tests.append(function)
+    return function
+
+
+class TestFailure(Exception):
+    pass
+
+
+class TestSkipped(Exception):
+    pass
+
+
+class Runner:
+    def __init__(self, shrek, modules):
+        self.shrek = os.path.abspath(shrek)
+        self.modules = [os.path.abspath(m) for m in modules]
+        self.directory = None
+
+    def write(self, name, text):
+        path = os.path.join(self.directory, name)
+        with open(path, 'wb') as fp:
+            fp.write(text.encode() if isinstance(text, str) else text)
+        return path
+
+    def run(self, *args, stdin=b''):
+        """Run the runtime in the test directory and return (stdout, stderr, exit code)."""
+        try:
+            result = subprocess.run([self.shrek, *args], cwd=self.directory, input=stdin, capture_output=True,
+                                    timeout=TIMEOUT)
+        except subprocess.TimeoutExpired:
+            raise TestFailure('timed out after {} s: shrek {}'.format(TIMEOUT, ' '.join(args)))
+        return result.stdout, result.stderr, result.returncode
+
+    def expect(self, args, stdout, code=0, stdin=b''):
+        out, err, rc = self.run(*args, stdin=stdin)
+        if out != stdout or rc != code:
+            raise TestFailure('shrek {}\n    expected exit {} and {!r}\n    got exit {} and {!r}\n    stderr {!r}'
+                              .format(' '.join(args), code, stdout, rc, out, err))
+        return out, err
+
+
+def cache_entries(runner):
+    directory = os.path.join(runner.directory, '.shrek_cache')
+    return sorted(os.path.join(directory, f) for f in os.listdir(directory) if f.endswith('.shrekc'))
+
+
+# Pushes 65 and writes it, so the program prints 0x41. Changing one "R" to a space keeps the size and prints 0x40.
+PRINT_A = 'S' + 'R' * 65 + ' SRE\n'
+PRINT_AT = 'S' + 'R' * 64 + '  SRE\n'
+
+
+@test
+def cache_reuses_entry(runner):
+    runner.write('a.shrek', PRINT_A)
+    runner.expect(['a.shrek'], b'0x41\n', 65)
+    _, err = runner.expect(['--stats', 'a.shrek'], b'0x41\n', 65)
+    if not err.startswith(b'load:'):
+        raise TestFailure('second run did not load from the cache: {!r}'.format(err))
+
+
+@test
+def cache_source_changed_same_size(runner):
+    runner.write('a.shrek', PRINT_A)
+    runner.expect(['a.shrek'], b'0x41\n', 65)
+    runner.write('a.shrek', PRINT_AT)
+    runner.expect(['a.shrek'], b'0x40\n', 64)
+
+
+@test
+def cache_hash_collision(runner):
+    # Give the entry for one program the file name and source hash of another program of the same size, as a hash
+    # collision would. The runtime must notice the source differs and parse again.
+    runner.write('a.shrek', PRINT_A)
+    runner.expect(['a.shrek'], b'0x41\n', 65)
+    (entry_a,) = cache_entries(runner)
+
+    runner.write('b.shrek', PRINT_AT)
+    runner.expect(['b.shrek'], b'0x40\n', 64)
+    (entry_b,) = [e for e in cache_entries(runner) if e != entry_a]
+
+    with open(entry_a, 'rb') as fp:
+        forged = bytearray(fp.read())
+    with open(entry_b, 'rb') as fp:
+        header_b = fp.read(24)
+
+    # The header starts with the magic number and version, followed by the 64 bit hash and the size of the source.
+    if struct.unpack_from('<Q', forged, 16) != struct.unpack_from('<Q', header_b, 16):
+        raise TestFailure('the two programs must have the same size')
+    forged[8:16] = header_b[8:16]
+    with open(entry_b, 'wb') as fp:
+        fp.write(forged)
+
+    runner.expect(['b.shrek'], b'0x40\n', 64)
+
+
+@test
+def steps_leave_out_halt(runner):
+    # Linking appends a halt, which is not an instruction of the program, so it is neither counted nor traced.
+    runner.write('a.shrek', 'S\n')
+    for dispatch in ('switch', 'threaded'):
+        _, err = runner.expect(['--no-cache', '--dispatch=' + dispatch, '--count-steps', 'a.shrek'], b'', 0)
+        if err != b'steps: 1\n':
+            raise TestFailure('--dispatch={} counted {!r}'.format(dispatch, err))
+
+        _, err = runner.expect(['--no-cache', '--dispatch=' + dispatch, '--trace', 'a.shrek'], b'', 0)
+        if len(err.splitlines()) != 1 or b'halt' in err:
+            raise TestFailure('--dispatch={} traced {!r}'.format(dispatch, err))
+
+
+# Registers two functions and then fails, by registering the first number again.
+PARTIAL_MODULE = r'''
+#include <shrek.h>
+
+#include <stdio.h>
+
+extern "C"
+{
+    int partial_func(ShrekHandle* shrek)
+    {
+        puts("partial_func");
+        return SHREK_OK;
+    }
+
+    shrek_EXPORTED_SYMBOL int partial_ext_register(ShrekHandle* shrek)
+    {
+        shrek_register_func(shrek, 102, partial_func);
+        shrek_register_func(shrek, 103, partial_func);
+        return shrek_register_func(shrek, 102, partial_func);
+    }
+}
+'''
+
+
+@test
+def module_register_fails_after_registering(runner):
+    # Functions a module registered before its register function failed stay in the function table, so the module
+    # must stay loaded for a call to them to work.
+    if os.name == 'nt':
+        raise TestSkipped('builds the module with a POSIX compiler')
+    compiler = shutil.which(os.environ.get('CXX', 'c++'))
+    if compiler is None:
+        raise TestSkipped('needs a C++ compiler, set with CXX')
+
+    include = os.path.join(os.path.dirname(os.path.dirname(os.path.abspath(__file__))), 'shrek')
+    source = runner.write('partial_ext.cpp', PARTIAL_MODULE)
+    module = os.path.join(runner.directory, 'partial_ext.dnky')
+    build = subprocess.run([compiler, '-std=c++17', '-shared', '-fPIC', '-I', include, '-o', module, source],
+                           capture_output=True)
+    if build.returncode != 0:
+        raise TestFailure('could not build the module: {!r}'.format(build.stderr))
+
+    runner.write('a.shrek', 'S' + 'R' * 102 + 'E\n')
+    out, err, code = runner.run('--no-cache', 'a.shrek')
+    if code != 0 or not out.endswith(b'partial_func\n'):
+        raise TestFailure('expected exit 0 and a call to partial_func\n    got exit {} and {!r}\n    stderr {!r}'
+                          .format(code, out, err))
+
+
+def read_directives(source):
+    """Read the comments of the form "# args: ...", "# exit: N" and "# module: name" at the top of a program, which set
+    the command line options, the expected exit code, which defaults to 0, and an extension module the program needs.
+    Returns (args, exit code, module).
+    """
+    args = []
+    code = 0
+    module = None
+    for line in source.decode().splitlines():
+        if line.startswith('# args:'):
+            args = line[len('# args:'):].split()
+        elif line.startswith('# exit:'):
+            code = int(line[len('# exit:'):])
+        elif line.startswith('# module:'):
+            module = line[len('# module:'):].strip()
+
+    return args, code, module
+
+
+def read_program(path):
+    """Read a program test. Returns (source, args, exit code, module, expected stdout).
+
+    The expected output is in a file next to the program, with the extension .out, and is compared byte for byte.
+    """
+    with open(path, 'rb') as fp:
+        source = fp.read()
+
+    args, code, module = read_directives(source)
+
+    with open(os.path.splitext(path)[0] + '.out', 'rb') as fp:
+        stdout = fp.read()
+
+    return source, args, code, module, stdout
+
+
+def needs_module(runner, module):
+    if module and not any(os.path.splitext(os.path.basename(m))[0] == module for m in runner.modules):
+        raise TestSkipped('needs --module {}.dnky'.format(module))
+
+
+def program_test(path):
+    def run_program(runner):
+        source, args, code, module, stdout = read_program(path)
+        needs_module(runner, module)
+
+        runner.write('program.shrek', source)
+        runner.expect(args + ['--no-cache', 'program.shrek'], stdout, code)
+
+    run_program.__name__ = os.path.splitext(os.path.basename(path))[0]
+    return run_program
+
+
+def jit_test(path):
+    """Run a program with and without --jit and check the output and exit code are the same. Where the JIT is not
+    supported, both runs use the interpreter.
+    """
+    def run_jit(runner):
+        with open(path, 'rb') as fp:
+            source = fp.read()
+
+        args, _, module = read_directives(source)
+        needs_module(runner, module)
+
+        runner.write('program.shrek', source)
+        args = args + ['--no-cache', 'program.shrek']
+        out, _, code = runner.run(*args)
+        runner.expect(['--jit'] + args, out, code)
+
+    run_jit.__name__ = 'jit_' + os.path.splitext(os.path.basename(path))[0]
+    return run_jit
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Run the SHREK regression tests.')
+    parser.add_argument('shrek', help='path to the shrek executable')
+    parser.add_argument('--module', action='append', default=[], help='extension module to load in every test')
+    parser.add_argument('-k', dest='filter', default='', help='only run tests whose name contains this text')
+    options = parser.parse_args()
+
+    runner = Runner(options.shrek, options.module)
+    failed = 0
+    skipped = 0
+    ran = 0
+
+    programs = []
+    if os.path.isdir(PROGRAMS):
+        programs = [os.path.join(PROGRAMS, f) for f in sorted(os.listdir(PROGRAMS)) if f.endswith('.shrek')]
+    tests.extend(program_test(path) for path in programs)
+    tests.extend(jit_test(path) for path in SAMPLES + programs)
+
+    for function in tests:
+        name = function.__name__
+        if options.filter not in name:
+            continue
+
+        runner.directory = tempfile.mkdtemp(prefix='shrek_test_')
+        try:
+            for module in runner.modules:
+                shutil.copy(module, runner.directory)
+
+            function(runner)
+            print('PASS', name)
+        except TestSkipped as ex:
+            skipped += 1
+            print('SKIP', name, '-', ex)
+        except TestFailure as ex:
+            failed += 1
+            print('FAIL', name)
+            print('   ', ex)
+        finally:
+            shutil.rmtree(runner.directory, ignore_errors=True)
+
+        ran += 1
+
+    print('{} tests, {} failed, {} skipped'.format(ran, failed, skipped))
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())